@@ -0,0 +1,483 @@
+#include "../HitManager.h"
+#include "../HitOwner.h"
+#include "../HitReplication.h"
+#include "../HitTrace.h"
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include <EASTL/algorithm.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+
+// Count heap allocations made through global operator new.
+namespace
+{
+
+std::atomic<unsigned long long> numAllocations{0};
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    ++numAllocations;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    ++numAllocations;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+using namespace Urho3D;
+
+namespace
+{
+
+struct BenchmarkSettings
+{
+    unsigned numOwners_{1000};
+    unsigned numDetectorsPerOwner_{4};
+    unsigned numTriggerOwners_{100};
+    unsigned numTriggersPerOwner_{2};
+    unsigned numGroups_{4};
+    float fadeOut_{0.0f};
+    float timeStep_{1.0f / 60.0f};
+    unsigned numFrames_{600};
+    /// Fraction of raw hits removed and re-added every frame in steady state.
+    float churn_{0.05f};
+    unsigned numHitsPerDetector_{2};
+    unsigned numThreads_{0};
+    /// Hit trace to replay instead of synthetic scenarios.
+    ea::string replayFileName_;
+};
+
+struct ScenarioResult
+{
+    unsigned numFrames_{};
+    double totalFrameTime_{};
+    double maxFrameTime_{};
+    /// Time spent adding and removing raw hits before updates, measured separately from frame time.
+    double totalChurnTime_{};
+    unsigned long long numAllocations_{};
+    unsigned long long numEvents_{};
+    unsigned long long numBytesReplicated_{};
+    /// Whether client had different number of hits than server after the scenario.
+    bool isReplicationMismatch_{};
+};
+
+/// Counts hit events without touching the event system.
+class CountingListener : public HitListener
+{
+public:
+    void OnHitStarted(const GroupHitInfo& hit) override { ++numEvents_; }
+    void OnHitStopped(const GroupHitInfo& hit) override { ++numEvents_; }
+
+    unsigned long long numEvents_{};
+};
+
+struct RawHit
+{
+    HitDetector* detector_{};
+    HitTrigger* trigger_{};
+};
+
+class HitBenchmark
+{
+public:
+    HitBenchmark(Context* context, const BenchmarkSettings& settings)
+        : context_(context)
+        , settings_(settings)
+    {
+        scene_ = MakeShared<Scene>(context_);
+        hitManager_ = scene_->CreateComponent<HitManager>();
+        hitManager_->SetParallelUpdate(settings_.numThreads_ > 0);
+        hitManager_->AddListener(&listener_);
+
+        CreateContent(scene_, true);
+    }
+
+    ~HitBenchmark() { hitManager_->RemoveListener(&listener_); }
+
+    ScenarioResult RunSteadyState()
+    {
+        AddAllHits();
+        UpdateFrames(1);
+
+        ScenarioResult result;
+        for (unsigned frame = 0; frame < settings_.numFrames_; ++frame)
+        {
+            HiresTimer churnTimer;
+            ChurnHits();
+            result.totalChurnTime_ += churnTimer.GetUSec(false) / 1000.0;
+
+            MeasureFrame(result);
+        }
+
+        RemoveAllHits();
+        UpdateFrames(1 + FadeOutFrames());
+        return result;
+    }
+
+    ScenarioResult RunReplication()
+    {
+        // Client content is created in the same order, so node IDs match
+        auto clientScene = MakeShared<Scene>(context_);
+        auto clientHitManager = clientScene->CreateComponent<HitManager>();
+        clientHitManager->SetReplicationMode(HitReplicationMode::Client);
+        CreateContent(clientScene, false);
+
+        hitManager_->SetReplicationMode(HitReplicationMode::Server);
+        HitReplicationLoopback loopback{hitManager_};
+        loopback.AddClient(clientHitManager);
+
+        AddAllHits();
+        UpdateFrames(1);
+        loopback.Transfer();
+
+        ScenarioResult result;
+        const unsigned long long bytesBegin = loopback.GetNumBytesTransferred();
+        for (unsigned frame = 0; frame < settings_.numFrames_; ++frame)
+        {
+            HiresTimer churnTimer;
+            ChurnHits();
+            result.totalChurnTime_ += churnTimer.GetUSec(false) / 1000.0;
+
+            MeasureFrame(result);
+            loopback.Transfer();
+        }
+        result.numBytesReplicated_ = loopback.GetNumBytesTransferred() - bytesBegin;
+
+        ea::vector<const GroupHitInfo*> serverHits;
+        ea::vector<const GroupHitInfo*> clientHits;
+        hitManager_->EnumerateActiveHits(serverHits);
+        clientHitManager->EnumerateActiveHits(clientHits);
+        result.isReplicationMismatch_ = serverHits.size() != clientHits.size();
+
+        RemoveAllHits();
+        UpdateFrames(1 + FadeOutFrames());
+        return result;
+    }
+
+    ScenarioResult RunBurst()
+    {
+        ScenarioResult result;
+        const unsigned burstPeriod = ea::max(2u, FadeOutFrames() + 2);
+        for (unsigned frame = 0; frame < settings_.numFrames_; ++frame)
+        {
+            const unsigned phase = frame % burstPeriod;
+            HiresTimer churnTimer;
+            if (phase == 0)
+                AddAllHits();
+            else if (phase == 1)
+                RemoveAllHits();
+            result.totalChurnTime_ += churnTimer.GetUSec(false) / 1000.0;
+
+            MeasureFrame(result);
+        }
+
+        RemoveAllHits();
+        UpdateFrames(1 + FadeOutFrames());
+        return result;
+    }
+
+    ScenarioResult RunTeardown()
+    {
+        AddAllHits();
+        UpdateFrames(1);
+
+        ScenarioResult result;
+        for (Node* node : triggerOwnerNodes_)
+            node->Remove();
+        triggerOwnerNodes_.clear();
+        ongoingHits_.clear();
+
+        for (unsigned frame = 0; frame < 2 + FadeOutFrames(); ++frame)
+            MeasureFrame(result);
+        return result;
+    }
+
+private:
+    /// Raw hits are collected only for server scene, client scene gets the same nodes and components.
+    void CreateContent(Scene* scene, bool isServer)
+    {
+        ea::vector<HitTrigger*> triggers;
+        for (unsigned ownerIndex = 0; ownerIndex < settings_.numTriggerOwners_; ++ownerIndex)
+        {
+            Node* ownerNode = scene->CreateChild("Trigger Owner");
+            auto owner = ownerNode->CreateComponent<HitOwner>();
+            owner->SetTriggerFadeOut(settings_.fadeOut_);
+            if (isServer)
+                triggerOwnerNodes_.push_back(ownerNode);
+
+            for (unsigned index = 0; index < settings_.numTriggersPerOwner_; ++index)
+            {
+                auto trigger = ownerNode->CreateChild("Trigger")->CreateComponent<HitTrigger>();
+                trigger->SetGroupId(GetGroupName(index));
+                triggers.push_back(trigger);
+            }
+        }
+
+        for (unsigned ownerIndex = 0; ownerIndex < settings_.numOwners_; ++ownerIndex)
+        {
+            Node* ownerNode = scene->CreateChild("Detector Owner");
+            ownerNode->CreateComponent<HitOwner>();
+
+            for (unsigned index = 0; index < settings_.numDetectorsPerOwner_; ++index)
+            {
+                auto detector = ownerNode->CreateChild("Detector")->CreateComponent<HitDetector>();
+                detector->SetGroupId(GetGroupName(index));
+
+                if (!isServer)
+                    continue;
+
+                for (unsigned hitIndex = 0; hitIndex < settings_.numHitsPerDetector_ && !triggers.empty(); ++hitIndex)
+                {
+                    HitTrigger* trigger = triggers[RandomIndex(triggers.size())];
+                    ongoingHits_.push_back(RawHit{detector, trigger});
+                }
+            }
+        }
+    }
+
+    ea::string GetGroupName(unsigned index) const
+    {
+        return settings_.numGroups_ > 0 ? "Group" + ea::to_string(index % settings_.numGroups_) : EMPTY_STRING;
+    }
+
+    unsigned RandomIndex(unsigned size) { return size > 0 ? random_() % size : 0; }
+
+    unsigned FadeOutFrames() const
+    {
+        return static_cast<unsigned>(std::ceil(settings_.fadeOut_ / settings_.timeStep_));
+    }
+
+    void AddHit(const RawHit& hit) { hit.detector_->GetHitOwner()->AddOngoingHit(hit.detector_, hit.trigger_); }
+    void RemoveHit(const RawHit& hit) { hit.detector_->GetHitOwner()->RemoveOngoingHit(hit.detector_, hit.trigger_); }
+
+    void ChurnHits()
+    {
+        const unsigned numChurnHits = static_cast<unsigned>(ongoingHits_.size() * settings_.churn_);
+        for (unsigned i = 0; i < numChurnHits; ++i)
+        {
+            const unsigned index = RandomIndex(ongoingHits_.size());
+            RemoveHit(ongoingHits_[index]);
+        }
+        for (unsigned i = 0; i < numChurnHits; ++i)
+        {
+            const unsigned index = RandomIndex(ongoingHits_.size());
+            AddHit(ongoingHits_[index]);
+        }
+    }
+
+    void AddAllHits()
+    {
+        for (const RawHit& hit : ongoingHits_)
+            AddHit(hit);
+    }
+
+    void RemoveAllHits()
+    {
+        for (const RawHit& hit : ongoingHits_)
+            RemoveHit(hit);
+    }
+
+    void UpdateFrames(unsigned numFrames)
+    {
+        for (unsigned frame = 0; frame < numFrames; ++frame)
+            hitManager_->Update(settings_.timeStep_);
+    }
+
+    void MeasureFrame(ScenarioResult& result)
+    {
+        const unsigned long long allocationsBegin = numAllocations.load();
+        const unsigned long long eventsBegin = listener_.numEvents_;
+
+        HiresTimer timer;
+        hitManager_->Update(settings_.timeStep_);
+        const double frameTime = timer.GetUSec(false) / 1000.0;
+
+        ++result.numFrames_;
+        result.totalFrameTime_ += frameTime;
+        result.maxFrameTime_ = ea::max(result.maxFrameTime_, frameTime);
+        result.numAllocations_ += numAllocations.load() - allocationsBegin;
+        result.numEvents_ += listener_.numEvents_ - eventsBegin;
+    }
+
+    Context* context_{};
+    const BenchmarkSettings settings_;
+    std::mt19937 random_{0};
+
+    SharedPtr<Scene> scene_;
+    HitManager* hitManager_{};
+    CountingListener listener_;
+
+    ea::vector<Node*> triggerOwnerNodes_;
+    ea::vector<RawHit> ongoingHits_;
+};
+
+ScenarioResult RunReplay(Context* context, const BenchmarkSettings& settings)
+{
+    ScenarioResult result;
+    HitTraceReplayer replayer{context};
+    if (!replayer.LoadFile(settings.replayFileName_))
+        return result;
+
+    CountingListener listener;
+    HitManager* hitManager = replayer.GetHitManager();
+    hitManager->SetParallelUpdate(settings.numThreads_ > 0);
+    hitManager->AddListener(&listener);
+
+    while (true)
+    {
+        const unsigned long long allocationsBegin = numAllocations.load();
+        const unsigned long long eventsBegin = listener.numEvents_;
+
+        // Frame time includes applying recorded changes, same as physics callbacks in the original frame
+        HiresTimer timer;
+        if (!replayer.ReplayFrame())
+            break;
+        const double frameTime = timer.GetUSec(false) / 1000.0;
+
+        ++result.numFrames_;
+        result.totalFrameTime_ += frameTime;
+        result.maxFrameTime_ = ea::max(result.maxFrameTime_, frameTime);
+        result.numAllocations_ += numAllocations.load() - allocationsBegin;
+        result.numEvents_ += listener.numEvents_ - eventsBegin;
+    }
+
+    hitManager->RemoveListener(&listener);
+    return result;
+}
+
+void PrintResult(const char* name, const ScenarioResult& result)
+{
+    const double numFrames = ea::max(1u, result.numFrames_);
+    const double totalSeconds = result.totalFrameTime_ / 1000.0;
+    const double eventsPerSecond = totalSeconds > 0.0 ? result.numEvents_ / totalSeconds : 0.0;
+
+    printf("%-14s frames: %6u  avg: %9.4f ms  max: %9.4f ms  churn: %9.4f ms  allocs/frame: %10.2f  events: %10llu  "
+           "events/s: %12.0f\n",
+        name, result.numFrames_, result.totalFrameTime_ / numFrames, result.maxFrameTime_,
+        result.totalChurnTime_ / numFrames, result.numAllocations_ / numFrames, result.numEvents_, eventsPerSecond);
+
+    if (result.numBytesReplicated_ > 0 || result.isReplicationMismatch_)
+    {
+        printf("%-14s bytes/frame: %10.1f  bytes/event: %6.2f%s\n", "", result.numBytesReplicated_ / numFrames,
+            result.numEvents_ > 0 ? static_cast<double>(result.numBytesReplicated_) / result.numEvents_ : 0.0,
+            result.isReplicationMismatch_ ? "  CLIENT MISMATCH" : "");
+    }
+}
+
+void PrintUsage()
+{
+    printf("Usage: HitManagerBenchmark [options]\n"
+           "  --owners N            Number of detector owners\n"
+           "  --detectors N         Number of detectors per owner\n"
+           "  --trigger-owners N    Number of trigger owners\n"
+           "  --triggers N          Number of triggers per trigger owner\n"
+           "  --groups N            Number of distinct group ids\n"
+           "  --hits N              Number of raw hits per detector\n"
+           "  --fade-out T          Trigger fade out time in seconds\n"
+           "  --frames N            Number of measured frames per scenario\n"
+           "  --churn F             Fraction of raw hits replaced every steady state frame\n"
+           "  --threads N           Number of worker threads, enables parallel update if not zero\n"
+           "  --replay FILE         Replay hit trace recorded by HitManager::StartTraceRecording\n");
+}
+
+bool ParseSettings(int argc, char** argv, BenchmarkSettings& settings)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+            return false;
+
+        if (!strcmp(arg, "--owners"))
+            settings.numOwners_ = atoi(value);
+        else if (!strcmp(arg, "--detectors"))
+            settings.numDetectorsPerOwner_ = atoi(value);
+        else if (!strcmp(arg, "--trigger-owners"))
+            settings.numTriggerOwners_ = atoi(value);
+        else if (!strcmp(arg, "--triggers"))
+            settings.numTriggersPerOwner_ = atoi(value);
+        else if (!strcmp(arg, "--groups"))
+            settings.numGroups_ = atoi(value);
+        else if (!strcmp(arg, "--hits"))
+            settings.numHitsPerDetector_ = atoi(value);
+        else if (!strcmp(arg, "--fade-out"))
+            settings.fadeOut_ = static_cast<float>(atof(value));
+        else if (!strcmp(arg, "--frames"))
+            settings.numFrames_ = atoi(value);
+        else if (!strcmp(arg, "--churn"))
+            settings.churn_ = static_cast<float>(atof(value));
+        else if (!strcmp(arg, "--threads"))
+            settings.numThreads_ = atoi(value);
+        else if (!strcmp(arg, "--replay"))
+            settings.replayFileName_ = value;
+        else
+            return false;
+        ++i;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    if (!ParseSettings(argc, argv, settings))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    SharedPtr<Context> context = MakeShared<Context>();
+    RegisterSceneLibrary(context);
+    HitManager::RegisterObject(context);
+    HitOwner::RegisterObject(context);
+    HitComponent::RegisterObject(context);
+    HitDetector::RegisterObject(context);
+    HitTrigger::RegisterObject(context);
+
+    auto workQueue = MakeShared<WorkQueue>(context);
+    workQueue->Initialize(settings.numThreads_);
+    context->RegisterSubsystem(workQueue);
+
+    if (!settings.replayFileName_.empty())
+    {
+        printf("Replay: %s\n", settings.replayFileName_.c_str());
+        PrintResult("Replay", RunReplay(context, settings));
+        return 0;
+    }
+
+    printf("Owners: %u x %u detectors, trigger owners: %u x %u triggers, groups: %u, fade out: %.3f s\n",
+        settings.numOwners_, settings.numDetectorsPerOwner_, settings.numTriggerOwners_, settings.numTriggersPerOwner_,
+        settings.numGroups_, settings.fadeOut_);
+
+    PrintResult("Steady state", HitBenchmark(context, settings).RunSteadyState());
+    PrintResult("Burst", HitBenchmark(context, settings).RunBurst());
+    PrintResult("Teardown", HitBenchmark(context, settings).RunTeardown());
+    PrintResult("Replication", HitBenchmark(context, settings).RunReplication());
+    return 0;
+}
@@ -0,0 +1,314 @@
+#pragma once
+
+#include "_Plugin.h"
+
+#include <Urho3D/Container/Hash.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Core/Assert.h>
+#include <Urho3D/Math/MathDefs.h>
+#include <Urho3D/Math/StringHash.h>
+
+#include <EASTL/optional.h>
+#include <EASTL/string.h>
+#include <EASTL/tuple.h>
+#include <EASTL/type_traits.h>
+#include <EASTL/utility.h>
+#include <EASTL/vector.h>
+
+namespace Urho3D
+{
+
+class HitDetector;
+class HitOwner;
+class HitTrigger;
+
+/// Group identifier interned by HitManager. Default group corresponds to empty string.
+enum class HitGroupId : unsigned
+{
+    Default
+};
+
+/// Identifier of ongoing hit. Unique within the instance of HitOwner.
+enum class HitId : unsigned
+{
+    Invalid
+};
+
+/// Generational handle of HitOwner or HitComponent registered in HitManager.
+/// Handle of destroyed object is never reused, so it is safe to keep.
+/// Slot of the handle is retired when its generation is exhausted.
+enum class HitHandle : unsigned
+{
+    Invalid
+};
+
+/// Description of ongoing physical volume hit between HitTrigger and HitDetector.
+/// Components that belong to the same HitOwner never hit each other.
+/// There is no other filtering at this level.
+struct ComponentHitInfo
+{
+    HitHandle detector_{};
+    HitHandle trigger_{};
+    /// Hit found by continuous test of a trigger. Evaluated once and then removed.
+    bool transient_{};
+    /// Hit was evaluated by at least one update.
+    bool evaluated_{};
+    /// Explicit padding, so equal hits are stored as equal bytes in snapshots.
+    unsigned char padding_[2]{};
+};
+
+static_assert(sizeof(ComponentHitInfo) == 2 * sizeof(HitHandle) + 4, "ComponentHitInfo should have no implicit padding");
+
+/// Hashable lookup key of ComponentHitInfo.
+struct ComponentHitKey
+{
+    HitHandle detector_{};
+    HitHandle trigger_{};
+
+    bool operator==(const ComponentHitKey& rhs) const
+    {
+        return detector_ == rhs.detector_ && trigger_ == rhs.trigger_;
+    }
+
+    unsigned ToHash() const
+    {
+        unsigned hash = static_cast<unsigned>(detector_);
+        CombineHash(hash, static_cast<unsigned>(trigger_));
+        return hash;
+    }
+};
+
+/// Description of logical hit between two HitOwner objects. Created from HitRecord for API users.
+struct PLUGIN_CORE_HITMANAGER_API GroupHitInfo
+{
+    WeakPtr<HitOwner> detector_;
+    WeakPtr<HitOwner> trigger_;
+    ea::string detectorGroup_;
+    ea::string triggerGroup_;
+    /// Interned identifiers of the groups above, see HitManager::GetOrAddGroup.
+    HitGroupId detectorGroupId_{};
+    HitGroupId triggerGroupId_{};
+    HitId id_{};
+    /// HitManager frame index when hit started, see HitManager::GetFrameIndex.
+    unsigned startFrameIndex_{};
+    /// Time before already stopped hit expires.
+    ea::optional<float> timeToExpire_;
+
+    /// Merge key is used to compare and merge sets of hits from different frames.
+    /// Hits that belong to the same HitOwner are supposed to have unique key triplets.
+    auto MergeKey() const { return ea::tie(trigger_, detectorGroupId_, triggerGroupId_); }
+};
+
+/// Compact trivially copyable representation of GroupHitInfo used for internal processing.
+/// Owners are referenced by handles, see HitManager::MakeHitInfo.
+struct HitRecord
+{
+    HitHandle detector_{};
+    HitHandle trigger_{};
+    HitGroupId detectorGroup_{};
+    HitGroupId triggerGroup_{};
+    HitId id_{};
+    unsigned startFrameIndex_{};
+    /// Negative if hit is not fading.
+    double expirationTime_{-1.0};
+
+    bool IsFading() const { return expirationTime_ >= 0.0; }
+};
+
+static_assert(sizeof(HitRecord) <= 32, "HitRecord should stay compact");
+static_assert(ea::is_trivially_copyable<HitRecord>::value, "HitRecord should be trivially copyable");
+
+/// Hashable lookup key used to merge hits from different frames, equivalent to GroupHitInfo::MergeKey.
+struct GroupHitKey
+{
+    HitHandle trigger_{};
+    HitGroupId detectorGroup_{};
+    HitGroupId triggerGroup_{};
+
+    bool operator==(const GroupHitKey& rhs) const
+    {
+        return trigger_ == rhs.trigger_ && detectorGroup_ == rhs.detectorGroup_ && triggerGroup_ == rhs.triggerGroup_;
+    }
+
+    unsigned ToHash() const
+    {
+        unsigned hash = static_cast<unsigned>(trigger_);
+        CombineHash(hash, static_cast<unsigned>(detectorGroup_));
+        CombineHash(hash, static_cast<unsigned>(triggerGroup_));
+        return hash;
+    }
+};
+
+/// Open addressing table from hashable key to index, used for lookups that are rebuilt or updated every frame.
+/// Storage is kept when table is reset, so it does not allocate once it has grown to the working size.
+template <class Key> class HitKeyIndex
+{
+public:
+    /// Remove all keys and prepare storage for up to maxSize keys.
+    void Reset(unsigned maxSize)
+    {
+        unsigned capacity = MinCapacity;
+        while (capacity < maxSize * 2)
+            capacity *= 2;
+
+        entries_.clear();
+        entries_.resize(capacity);
+        mask_ = capacity - 1;
+        size_ = 0;
+    }
+
+    /// Insert key with index if key is not present yet. Returns index stored for the key and whether it was inserted.
+    ea::pair<unsigned, bool> Insert(const Key& key, unsigned index)
+    {
+        Entry& entry = FindOrAddEntry(key);
+        if (entry.index_ != M_MAX_UNSIGNED)
+            return {entry.index_, false};
+
+        entry.key_ = key;
+        entry.index_ = index;
+        ++size_;
+        return {index, true};
+    }
+
+    /// Insert key or replace index stored for the key.
+    void Set(const Key& key, unsigned index)
+    {
+        Entry& entry = FindOrAddEntry(key);
+        if (entry.index_ == M_MAX_UNSIGNED)
+        {
+            entry.key_ = key;
+            ++size_;
+        }
+        entry.index_ = index;
+    }
+
+    /// Return index stored for the key, or M_MAX_UNSIGNED if key is not present.
+    unsigned Find(const Key& key) const
+    {
+        if (entries_.empty())
+            return M_MAX_UNSIGNED;
+
+        for (unsigned position = key.ToHash() & mask_;; position = (position + 1) & mask_)
+        {
+            const Entry& entry = entries_[position];
+            if (entry.index_ == M_MAX_UNSIGNED || entry.key_ == key)
+                return entry.index_;
+        }
+    }
+
+    /// Remove key. Returns whether key was present.
+    bool Erase(const Key& key)
+    {
+        if (entries_.empty())
+            return false;
+
+        unsigned hole = key.ToHash() & mask_;
+        for (;; hole = (hole + 1) & mask_)
+        {
+            const Entry& entry = entries_[hole];
+            if (entry.index_ == M_MAX_UNSIGNED)
+                return false;
+            if (entry.key_ == key)
+                break;
+        }
+
+        // Move following entries of the probe sequence back, so lookups never stop at the hole
+        for (unsigned position = (hole + 1) & mask_;; position = (position + 1) & mask_)
+        {
+            const Entry& entry = entries_[position];
+            if (entry.index_ == M_MAX_UNSIGNED)
+                break;
+
+            const unsigned home = entry.key_.ToHash() & mask_;
+            if (((position - home) & mask_) >= ((position - hole) & mask_))
+            {
+                entries_[hole] = entry;
+                hole = position;
+            }
+        }
+
+        entries_[hole] = Entry{};
+        --size_;
+        return true;
+    }
+
+private:
+    static constexpr unsigned MinCapacity = 8;
+
+    struct Entry
+    {
+        Key key_{};
+        unsigned index_{M_MAX_UNSIGNED};
+    };
+
+    /// Return entry of the key or empty entry where it should be added. Table is grown to keep it half empty.
+    Entry& FindOrAddEntry(const Key& key)
+    {
+        if ((size_ + 1) * 2 > entries_.size())
+            Grow();
+
+        for (unsigned position = key.ToHash() & mask_;; position = (position + 1) & mask_)
+        {
+            Entry& entry = entries_[position];
+            if (entry.index_ == M_MAX_UNSIGNED || entry.key_ == key)
+                return entry;
+        }
+    }
+
+    void Grow()
+    {
+        const unsigned capacity = entries_.empty() ? MinCapacity : entries_.size() * 2;
+        ea::vector<Entry> entries(capacity);
+        ea::swap(entries, entries_);
+        mask_ = capacity - 1;
+
+        for (const Entry& entry : entries)
+        {
+            if (entry.index_ == M_MAX_UNSIGNED)
+                continue;
+
+            unsigned position = entry.key_.ToHash() & mask_;
+            while (entries_[position].index_ != M_MAX_UNSIGNED)
+                position = (position + 1) & mask_;
+            entries_[position] = entry;
+        }
+    }
+
+    ea::vector<Entry> entries_;
+    unsigned mask_{};
+    unsigned size_{};
+};
+
+/// Stable reference to ongoing or fading hit. Resolved via HitOwner::GetHitInfo of detector owner.
+struct HitReference
+{
+    const HitOwner* detector_{};
+    HitId id_{};
+
+    bool operator==(const HitReference& rhs) const { return detector_ == rhs.detector_ && id_ == rhs.id_; }
+
+    unsigned ToHash() const
+    {
+        unsigned hash = static_cast<unsigned>(ea::hash<const void*>{}(detector_));
+        CombineHash(hash, static_cast<unsigned>(id_));
+        return hash;
+    }
+};
+
+/// Hit start or stop that is dispatched to listeners.
+struct PLUGIN_CORE_HITMANAGER_API HitEvent
+{
+    /// Either E_HITSTARTED or E_HITSTOPPED.
+    StringHash eventType_;
+    GroupHitInfo hit_;
+};
+
+/// Hit start or stop that is calculated but not dispatched yet.
+struct PendingHitEvent
+{
+    /// Either E_HITSTARTED or E_HITSTOPPED.
+    StringHash eventType_;
+    HitRecord hit_;
+};
+
+} // namespace Urho3D
@@ -1,19 +1,221 @@
 #include "HitManager.h"
 
 #include "HitOwner.h"
+#include "HitReplication.h"
+#include "HitTrace.h"
 
 #include <Urho3D/Container/TransformedSpan.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsEvents.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Physics/RigidBody.h>
 #include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Scene/SceneEvents.h>
 
+#include <EASTL/heap.h>
+
 namespace Urho3D
 {
 
+namespace
+{
+
+const char* hitDetectionModeNames[] = {
+    "Physics",
+    "Shapes",
+    nullptr
+};
+
+const char* hitUpdateModeNames[] = {
+    "Scene Update",
+    "Physics Step",
+    nullptr
+};
+
+const char* hitReplicationModeNames[] = {
+    "None",
+    "Server",
+    "Client",
+    nullptr
+};
+
+/// Snapshot header, bump the version whenever layout of snapshot or hit records changes.
+const unsigned hitSnapshotMagic = 0x53544948; // "HITS"
+const unsigned hitSnapshotVersion = 2;
+
+/// Empty buckets of hit index without removing them.
+template <class T> void ClearBuckets(T& index)
+{
+    for (auto& item : index)
+        item.second.clear();
+}
+
+template <class T> void RemoveEmptyBuckets(T& index)
+{
+    for (auto iter = index.begin(); iter != index.end();)
+    {
+        if (iter->second.empty())
+            iter = index.erase(iter);
+        else
+            ++iter;
+    }
+}
+
+/// Hit identifiers are replicated as two numbers, so small slot index and generation are both short.
+const unsigned ReplicatedHitIdLowBits = 20;
+const unsigned ReplicatedHitIdLowMask = (1u << ReplicatedHitIdLowBits) - 1;
+
+unsigned GetOwnerNodeId(const HitOwner* owner)
+{
+    const Node* node = owner ? owner->GetNode() : nullptr;
+    return node ? node->GetID() : 0;
+}
+
+HitOwner* FindOwnerByNodeId(Scene* scene, unsigned nodeId)
+{
+    Node* node = nodeId != 0 ? scene->GetNode(nodeId) : nullptr;
+    return node ? node->GetComponent<HitOwner>() : nullptr;
+}
+
+} // namespace
+
+HitStatistics& HitStatistics::operator+=(const HitStatistics& rhs)
+{
+    numOwnersProcessed_ += rhs.numOwnersProcessed_;
+    numComponentHits_ += rhs.numComponentHits_;
+    numGroupHits_ += rhs.numGroupHits_;
+    numHitsStarted_ += rhs.numHitsStarted_;
+    numHitsStopped_ += rhs.numHitsStopped_;
+    numHitsFading_ += rhs.numHitsFading_;
+    numEventsDispatched_ += rhs.numEventsDispatched_;
+    numEventsQueued_ += rhs.numEventsQueued_;
+    numPhysicsSteps_ += rhs.numPhysicsSteps_;
+    removeExpiredRawHitsTime_ += rhs.removeExpiredRawHitsTime_;
+    calculateGroupHitsTime_ += rhs.calculateGroupHitsTime_;
+    startAndStopHitsTime_ += rhs.startAndStopHitsTime_;
+    sendEventsTime_ += rhs.sendEventsTime_;
+    return *this;
+}
+
+bool HitFilter::Matches(const GroupHitInfo& hit, unsigned frameIndex) const
+{
+    if (detectorGroup_ && hit.detectorGroupId_ != *detectorGroup_)
+        return false;
+    if (triggerGroup_ && hit.triggerGroupId_ != *triggerGroup_)
+        return false;
+    if (detector_ && hit.detector_.Get() != detector_)
+        return false;
+    if (trigger_ && hit.trigger_.Get() != trigger_)
+        return false;
+    if (startedThisFrame_ && hit.startFrameIndex_ != frameIndex)
+        return false;
+    if (fadingOnly_ && !hit.timeToExpire_)
+        return false;
+    return true;
+}
+
+HitCursor::HitCursor(HitManager* hitManager, const HitFilter& filter)
+    : hitManager_(hitManager)
+    , filter_(filter)
+    , frameIndex_(hitManager->GetFrameIndex())
+    , isFadingHits_(filter.fadingOnly_)
+{
+    // Hits of specific detector are stored in one owner
+    if (filter_.detector_)
+        owner_ = filter_.detector_->GetRegistry() == hitManager_ ? filter_.detector_ : nullptr;
+    else
+        AdvanceOwner();
+}
+
+const GroupHitInfo* HitCursor::Next()
+{
+    while (owner_)
+    {
+        const ea::span<const GroupHitInfo> hits = isFadingHits_ ? owner_->GetFadingHits() : owner_->GetOngoingHits();
+        while (hitIndex_ < hits.size())
+        {
+            const GroupHitInfo& hit = hits[hitIndex_++];
+            if (filter_.Matches(hit, frameIndex_))
+                return &hit;
+        }
+
+        hitIndex_ = 0;
+        if (!isFadingHits_)
+            isFadingHits_ = true;
+        else if (filter_.detector_ || !AdvanceOwner())
+            owner_ = nullptr;
+        else
+            isFadingHits_ = filter_.fadingOnly_;
+    }
+    return nullptr;
+}
+
+bool HitCursor::AdvanceOwner()
+{
+    const auto owners = hitManager_->GetTrackedComponents();
+    if (ownerIndex_ >= owners.size())
+    {
+        owner_ = nullptr;
+        return false;
+    }
+
+    owner_ = static_cast<const HitOwner*>(owners[ownerIndex_++]);
+    return true;
+}
+
+void HitListenerList::Add(HitListener* listener)
+{
+    if (!listener)
+        return;
+
+    if (ea::find(listeners_.begin(), listeners_.end(), listener) != listeners_.end())
+        return;
+
+    listeners_.push_back(listener);
+    ++numListeners_;
+}
+
+void HitListenerList::Remove(HitListener* listener)
+{
+    if (!listener)
+        return;
+
+    const auto iter = ea::find(listeners_.begin(), listeners_.end(), listener);
+    if (iter == listeners_.end())
+        return;
+
+    --numListeners_;
+    if (notificationDepth_ > 0)
+        *iter = nullptr;
+    else
+        listeners_.erase(iter);
+}
+
+void HitListenerList::Notify(const GroupHitInfo& hit, void (HitListener::*callback)(const GroupHitInfo&))
+{
+    ++notificationDepth_;
+    for (unsigned index = 0; index < listeners_.size(); ++index)
+    {
+        if (HitListener* listener = listeners_[index])
+            (listener->*callback)(hit);
+    }
+    --notificationDepth_;
+
+    if (notificationDepth_ == 0 && numListeners_ != listeners_.size())
+        ea::erase(listeners_, nullptr);
+}
+
 HitManager::HitManager(Context* context)
     : TrackedComponentRegistryBase(context, HitOwner::GetTypeStatic())
 {
 }
 
+HitManager::~HitManager() = default;
+
 void HitManager::RegisterObject(Context* context)
 {
     context->RegisterFactory<HitManager>(Category_Plugin_HitManager);
@@ -23,6 +225,16 @@ void HitManager::RegisterObject(Context* context)
     URHO3D_ATTRIBUTE("Trigger Collision Layer", unsigned, triggerCollisionLayer_, DefaultTriggerCollisionLayer, AM_DEFAULT);
     URHO3D_ATTRIBUTE("Detector Collision Mask", unsigned, detectorCollisionMask_, DefaultDetectorCollisionMask, AM_DEFAULT);
     URHO3D_ATTRIBUTE("Detector Collision Layer", unsigned, detectorCollisionLayer_, DefaultDetectorCollisionLayer, AM_DEFAULT);
+    URHO3D_ENUM_ATTRIBUTE("Detection Mode", detectionMode_, hitDetectionModeNames, HitDetectionMode::Physics, AM_DEFAULT);
+    URHO3D_ENUM_ACCESSOR_ATTRIBUTE("Update Mode", GetUpdateMode, SetUpdateMode, HitUpdateMode, hitUpdateModeNames, HitUpdateMode::SceneUpdate, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Parallel Update", bool, parallelUpdate_, false, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Send Hit Events", bool, sendHitEvents_, true, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Send Batched Events", bool, sendBatchedEvents_, false, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Group Pairs Allowed By Default", GetGroupPairsAllowedByDefault, SetGroupPairsAllowedByDefault, bool, true, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Max Pooled Bodies", unsigned, maxPooledBodies_, DefaultMaxPooledBodies, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Max Dispatched Events", unsigned, maxDispatchedEvents_, 0, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Dispatch Time Budget", float, dispatchTimeBudget_, 0.0f, AM_DEFAULT);
+    URHO3D_ENUM_ACCESSOR_ATTRIBUTE("Replication Mode", GetReplicationMode, SetReplicationMode, HitReplicationMode, hitReplicationModeNames, HitReplicationMode::None, AM_DEFAULT);
     // clang-format on
 }
 
@@ -36,24 +248,1355 @@ void HitManager::EnumerateActiveHits(ea::vector<const GroupHitInfo*>& hits)
     }
 }
 
+HitGroupId HitManager::GetOrAddGroup(const ea::string& groupName)
+{
+    const auto iter = groupIds_.find(groupName);
+    if (iter != groupIds_.end())
+        return iter->second;
+
+    const auto groupId = static_cast<HitGroupId>(groupNames_.size());
+    groupNames_.push_back(groupName);
+    groupIds_.emplace(groupName, groupId);
+    CompileGroupPairMatrix();
+    return groupId;
+}
+
+const ea::string& HitManager::GetGroupName(HitGroupId groupId) const
+{
+    const auto index = static_cast<unsigned>(groupId);
+    return index < groupNames_.size() ? groupNames_[index] : EMPTY_STRING;
+}
+
+void HitManager::SetGroupPairAllowed(HitGroupId detectorGroup, HitGroupId triggerGroup, bool allowed)
+{
+    const unsigned long long key =
+        (static_cast<unsigned long long>(detectorGroup) << 32) | static_cast<unsigned>(triggerGroup);
+    groupPairRules_[key] = allowed;
+    CompileGroupPairMatrix();
+}
+
+void HitManager::SetGroupPairAllowed(const ea::string& detectorGroup, const ea::string& triggerGroup, bool allowed)
+{
+    SetGroupPairAllowed(GetOrAddGroup(detectorGroup), GetOrAddGroup(triggerGroup), allowed);
+}
+
+void HitManager::ResetGroupPairRules()
+{
+    groupPairRules_.clear();
+    CompileGroupPairMatrix();
+}
+
+void HitManager::SetGroupPairsAllowedByDefault(bool allowed)
+{
+    groupPairsAllowedByDefault_ = allowed;
+    CompileGroupPairMatrix();
+}
+
+bool HitManager::IsGroupPairAllowed(HitGroupId detectorGroup, HitGroupId triggerGroup) const
+{
+    const auto detectorIndex = static_cast<unsigned>(detectorGroup);
+    const auto triggerIndex = static_cast<unsigned>(triggerGroup);
+    if (detectorIndex >= groupNames_.size() || triggerIndex >= groupNames_.size())
+        return groupPairsAllowedByDefault_;
+
+    const unsigned word = groupPairMatrix_[detectorIndex * groupPairMatrixStride_ + triggerIndex / 32];
+    return (word >> (triggerIndex % 32)) & 1u;
+}
+
+bool HitManager::IsTeamPairAllowed(const HitOwner* detectorOwner, const HitOwner* triggerOwner) const
+{
+    return (detectorOwner->GetTeamMask() & triggerOwner->GetTargetTeamMask()) != 0;
+}
+
+void HitManager::SetGroupDispatchPriority(HitGroupId groupId, HitDispatchPriority priority)
+{
+    const auto index = static_cast<unsigned>(groupId);
+    if (index >= groupDispatchPriorities_.size())
+        groupDispatchPriorities_.resize(index + 1, HitDispatchPriority::Immediate);
+    groupDispatchPriorities_[index] = priority;
+}
+
+void HitManager::SetGroupDispatchPriority(const ea::string& groupName, HitDispatchPriority priority)
+{
+    SetGroupDispatchPriority(GetOrAddGroup(groupName), priority);
+}
+
+HitDispatchPriority HitManager::GetGroupDispatchPriority(HitGroupId groupId) const
+{
+    const auto index = static_cast<unsigned>(groupId);
+    return index < groupDispatchPriorities_.size() ? groupDispatchPriorities_[index] : HitDispatchPriority::Immediate;
+}
+
+void HitManager::CompileGroupPairMatrix()
+{
+    const unsigned numGroups = groupNames_.size();
+    groupPairMatrixStride_ = (numGroups + 31) / 32;
+
+    const unsigned defaultWord = groupPairsAllowedByDefault_ ? M_MAX_UNSIGNED : 0u;
+    groupPairMatrix_.assign(numGroups * groupPairMatrixStride_, defaultWord);
+
+    for (const auto& [key, allowed] : groupPairRules_)
+    {
+        const auto detectorIndex = static_cast<unsigned>(key >> 32);
+        const auto triggerIndex = static_cast<unsigned>(key);
+        if (detectorIndex >= numGroups || triggerIndex >= numGroups)
+            continue;
+
+        unsigned& word = groupPairMatrix_[detectorIndex * groupPairMatrixStride_ + triggerIndex / 32];
+        const unsigned bit = 1u << (triggerIndex % 32);
+        word = allowed ? (word | bit) : (word & ~bit);
+    }
+}
+
+void HitManager::ScheduleUpdate(HitOwner* owner)
+{
+    if (owner->GetScheduledIndex() != M_MAX_UNSIGNED)
+        return;
+
+    owner->SetScheduledIndex(scheduledOwners_.size());
+    scheduledOwners_.push_back(owner);
+}
+
+void HitManager::SetUpdateMode(HitUpdateMode mode)
+{
+    if (updateMode_ == mode)
+        return;
+
+    updateMode_ = mode;
+    if (Scene* scene = GetScene())
+        SubscribeToUpdateEvents(scene);
+    if (traceRecorder_)
+        traceRecorder_->RecordUpdateMode(mode);
+}
+
+void HitManager::SubscribeToUpdateEvents(Scene* scene)
+{
+    UnsubscribeFromEvent(E_SCENESUBSYSTEMUPDATE);
+    UnsubscribeFromEvent(E_PHYSICSPOSTSTEP);
+    UnsubscribeFromEvent(E_SCENEPOSTUPDATE);
+    numPendingPhysicsSteps_ = 0;
+    pendingPhysicsTime_ = 0.0f;
+
+    if (!scene)
+        return;
+
+    if (updateMode_ == HitUpdateMode::SceneUpdate)
+        SubscribeToEvent(scene, E_SCENESUBSYSTEMUPDATE, &HitManager::OnSceneSubsystemUpdate);
+    else
+    {
+        // PhysicsWorld may be created later, steps of other scenes are rejected by handler
+        SubscribeToEvent(E_PHYSICSPOSTSTEP, &HitManager::OnPhysicsPostStep);
+        SubscribeToEvent(scene, E_SCENEPOSTUPDATE, &HitManager::OnScenePostUpdate);
+    }
+}
+
 void HitManager::OnAddedToScene(Scene* scene)
 {
-    SubscribeToEvent(scene, E_SCENESUBSYSTEMUPDATE, &HitManager::Update);
+    physicsWorld_ = scene->GetComponent<PhysicsWorld>();
+    SubscribeToUpdateEvents(scene);
+
+    // PhysicsWorld may be created later, bodies of other scenes are rejected by lookup
+    SubscribeToEvent(E_PHYSICSCOLLISIONSTART, [this](VariantMap& eventData) { OnPhysicsCollision(eventData, true); });
+    SubscribeToEvent(E_PHYSICSCOLLISIONEND, [this](VariantMap& eventData) { OnPhysicsCollision(eventData, false); });
 }
 
 void HitManager::OnRemovedFromScene()
 {
-    UnsubscribeFromEvent(E_SCENESUBSYSTEMUPDATE);
+    physicsWorld_ = nullptr;
+    SubscribeToUpdateEvents(nullptr);
+    UnsubscribeFromEvent(E_PHYSICSCOLLISIONSTART);
+    UnsubscribeFromEvent(E_PHYSICSCOLLISIONEND);
+    ClearScheduledOwners();
+    hitExpirations_.clear();
+    indexedHitIndex_.Reset(0);
+    indexedHits_.clear();
+    hitsByTrigger_.clear();
+    hitsByGroup_.clear();
+    hitsByPair_.clear();
+    ClearDispatchQueue();
+    batchedEvents_.clear();
+
+    // Scene may be iterating components of the nodes, bodies are left to be destroyed with them
+    releasedBodies_.clear();
 }
 
-void HitManager::Update(VariantMap& eventData)
+void HitManager::OnComponentAdded(TrackedComponentBase* baseComponent)
 {
-    URHO3D_PROFILE("Update Hits");
+    auto owner = static_cast<HitOwner*>(baseComponent);
+    owner->SetHitHandle(AddHitObject(owner));
+
+    if (!owner->IsIdle())
+        ScheduleUpdate(owner);
+}
+
+void HitManager::OnComponentRemoved(TrackedComponentBase* baseComponent)
+{
+    auto owner = static_cast<HitOwner*>(baseComponent);
+    RemoveIndexedHitsOfOwner(owner);
+    RemoveHitObject(owner->GetHitHandle());
+    owner->SetHitHandle(HitHandle::Invalid);
 
+    const unsigned index = owner->GetScheduledIndex();
+    if (index == M_MAX_UNSIGNED)
+        return;
+
+    scheduledOwners_[index] = nullptr;
+    owner->SetScheduledIndex(M_MAX_UNSIGNED);
+}
+
+void HitManager::SendBatchedEvents()
+{
+    if (batchedEvents_.empty())
+        return;
+
+    VariantMap& eventData = GetEventDataMap();
+    eventData[HitBatch::P_HITMANAGER] = this;
+    eventData[HitBatch::P_NUMEVENTS] = static_cast<unsigned>(batchedEvents_.size());
+    GetScene()->SendEvent(E_HITBATCH, eventData);
+
+    batchedEvents_.clear();
+}
+
+void HitManager::RemoveIdleOwners()
+{
+    unsigned numOwners = 0;
+    for (HitOwner* owner : scheduledOwners_)
+    {
+        if (!owner)
+            continue;
+
+        if (owner->IsIdle())
+        {
+            owner->SetScheduledIndex(M_MAX_UNSIGNED);
+            continue;
+        }
+
+        owner->SetScheduledIndex(numOwners);
+        scheduledOwners_[numOwners++] = owner;
+    }
+    scheduledOwners_.resize(numOwners);
+}
+
+void HitManager::ClearScheduledOwners()
+{
+    for (HitOwner* owner : scheduledOwners_)
+    {
+        if (owner)
+            owner->SetScheduledIndex(M_MAX_UNSIGNED);
+    }
+    scheduledOwners_.clear();
+}
+
+void HitManager::OnSceneSubsystemUpdate(VariantMap& eventData)
+{
     const float timeStep = eventData[SceneSubsystemUpdate::P_TIMESTEP].GetFloat();
-    const auto owners = StaticCastSpan<HitOwner*>(GetTrackedComponents());
-    for (HitOwner* owner : owners)
-        owner->UpdateEvents(timeStep);
+    Update(timeStep);
+}
+
+void HitManager::OnPhysicsPostStep(VariantMap& eventData)
+{
+    const auto physicsWorld = static_cast<PhysicsWorld*>(eventData[PhysicsPostStep::P_WORLD].GetPtr());
+    if (!physicsWorld || physicsWorld->GetScene() != GetScene())
+        return;
+
+    physicsWorld_ = physicsWorld;
+    ++numPendingPhysicsSteps_;
+    pendingPhysicsTime_ += eventData[PhysicsPostStep::P_TIMESTEP].GetFloat();
+}
+
+void HitManager::OnScenePostUpdate(VariantMap& eventData)
+{
+    // Hits that don't come from physics contacts still need updates, and so do queued and batched events
+    if (!IsUpdatedByPhysicsSteps())
+    {
+        numPendingPhysicsSteps_ = 0;
+        pendingPhysicsTime_ = 0.0f;
+        Update(eventData[ScenePostUpdate::P_TIMESTEP].GetFloat());
+        return;
+    }
+
+    // Contacts don't change between physics steps, so there is nothing to evaluate, but events are still delivered
+    if (numPendingPhysicsSteps_ == 0)
+    {
+        statistics_ = {};
+        DispatchQueuedEvents(false);
+        SendBatchedEvents();
+        return;
+    }
+
+    const unsigned numSteps = numPendingPhysicsSteps_;
+    const float timeStep = pendingPhysicsTime_;
+    numPendingPhysicsSteps_ = 0;
+    pendingPhysicsTime_ = 0.0f;
+
+    Update(timeStep);
+    statistics_.numPhysicsSteps_ = numSteps;
+}
+
+bool HitManager::IsUpdatedByPhysicsSteps() const
+{
+    return detectionMode_ == HitDetectionMode::Physics && replicationMode_ != HitReplicationMode::Client
+        && physicsWorld_;
+}
+
+void HitManager::OnPhysicsCollision(VariantMap& eventData, bool isStarted)
+{
+    // Start and end events have the same parameters
+    const auto bodyA = static_cast<RigidBody*>(eventData[PhysicsCollisionStart::P_BODYA].GetPtr());
+    const auto bodyB = static_cast<RigidBody*>(eventData[PhysicsCollisionStart::P_BODYB].GetPtr());
+    if (!bodyA || !bodyB)
+        return;
+
+    const unsigned layerA = bodyA->GetCollisionLayer();
+    const unsigned layerB = bodyB->GetCollisionLayer();
+    const bool isDetectorA = (layerA & detectorBodyLayers_) && (layerB & triggerBodyLayers_);
+    const bool isDetectorB = (layerB & detectorBodyLayers_) && (layerA & triggerBodyLayers_);
+    if (!isDetectorA && !isDetectorB)
+        return;
+
+    const HitBody* hitBodyA = FindHitBody(bodyA);
+    const HitBody* hitBodyB = FindHitBody(bodyB);
+    if (!hitBodyA || !hitBodyB)
+        return;
+
+    const auto notifyDetectors = [isStarted](const HitBody& detectorBody, const HitBody& triggerBody)
+    {
+        if (!triggerBody.trigger_)
+            return;
+
+        for (HitDetector* detector : detectorBody.detectors_)
+        {
+            if (isStarted)
+                detector->OnHitStarted(triggerBody.trigger_);
+            else
+                detector->OnHitStopped(triggerBody.trigger_);
+        }
+    };
+
+    notifyDetectors(*hitBodyA, *hitBodyB);
+    notifyDetectors(*hitBodyB, *hitBodyA);
+}
+
+void HitManager::Update(float timeStep)
+{
+    URHO3D_PROFILE("Update Hits");
+
+    statistics_ = {};
+    ++frameIndex_;
+    ++evaluationIndex_;
+    elapsedTime_ += timeStep;
+
+    PoolReleasedBodies();
+
+    // Client receives hits from server, so owners are never updated locally
+    if (replicationMode_ == HitReplicationMode::Client)
+    {
+        DispatchQueuedEvents(false);
+        SendBatchedEvents();
+        return;
+    }
+
+    if (traceRecorder_)
+        traceRecorder_->RecordBeginFrame(frameIndex_, timeStep);
+
+    // Shapes are needed in Physics mode only for continuous triggers
+    const bool isShapesMode = detectionMode_ == HitDetectionMode::Shapes;
+    if (isShapesMode || !continuousTriggers_.empty())
+    {
+        URHO3D_PROFILE("Update Hit Shapes");
+        broadphase_.UpdateShapes(timeStep);
+        if (isShapesMode)
+            broadphase_.UpdatePairs();
+    }
+
+    SweepContinuousTriggers();
+
+    const bool isParallelUpdate = parallelUpdate_ && scheduledOwners_.size() > ParallelUpdateBatchSize;
+    if (traceRecorder_)
+        traceRecorder_->RecordUpdateOwners(isParallelUpdate);
+
+    if (isParallelUpdate)
+        UpdateOwnersInParallel();
+    else
+    {
+        // Owners may be scheduled or removed by event handlers, so iterate by index
+        for (unsigned index = 0; index < scheduledOwners_.size(); ++index)
+        {
+            if (HitOwner* owner = scheduledOwners_[index])
+            {
+                BeginOwnerStep();
+                owner->PrepareUpdate(evaluationIndex_);
+                owner->UpdateEvents(statistics_);
+            }
+        }
+    }
+
+    // Hits restarted during owner update should not expire
+    ExpireFadingHits();
+
+    DispatchQueuedEvents(false);
+    SendBatchedEvents();
+    RemoveIdleOwners();
+
+    if (traceRecorder_)
+        traceRecorder_->RecordEndFrame();
+}
+
+Component* HitManager::GetHitObject(HitHandle handle) const
+{
+    const unsigned value = static_cast<unsigned>(handle);
+    const unsigned slotIndex = (value & HitHandleSlotMask) - 1;
+    const unsigned generation = value >> HitHandleSlotBits;
+    if (handle == HitHandle::Invalid || slotIndex >= hitObjects_.size())
+        return nullptr;
+
+    const HitObjectSlot& slot = hitObjects_[slotIndex];
+    return slot.generation_ == generation ? slot.object_ : nullptr;
+}
+
+GroupHitInfo HitManager::MakeHitInfo(const HitRecord& record) const
+{
+    GroupHitInfo hit;
+    hit.detector_ = GetHitObject<HitOwner>(record.detector_);
+    hit.trigger_ = GetHitObject<HitOwner>(record.trigger_);
+    hit.detectorGroup_ = GetGroupName(record.detectorGroup_);
+    hit.triggerGroup_ = GetGroupName(record.triggerGroup_);
+    hit.detectorGroupId_ = record.detectorGroup_;
+    hit.triggerGroupId_ = record.triggerGroup_;
+    hit.id_ = record.id_;
+    hit.startFrameIndex_ = record.startFrameIndex_;
+    if (record.IsFading())
+        hit.timeToExpire_ = static_cast<float>(record.expirationTime_ - elapsedTime_);
+    return hit;
+}
+
+HitHandle HitManager::AddHitObject(Component* object)
+{
+    unsigned slotIndex = 0;
+    if (!freeHitObjects_.empty())
+    {
+        slotIndex = freeHitObjects_.back();
+        freeHitObjects_.pop_back();
+    }
+    else
+    {
+        slotIndex = hitObjects_.size();
+        URHO3D_ASSERT(slotIndex < HitHandleSlotMask);
+        hitObjects_.emplace_back();
+    }
+
+    HitObjectSlot& slot = hitObjects_[slotIndex];
+    slot.object_ = object;
+    return static_cast<HitHandle>((slot.generation_ << HitHandleSlotBits) | (slotIndex + 1));
+}
+
+void HitManager::RemoveHitObject(HitHandle handle)
+{
+    if (!GetHitObject(handle))
+        return;
+
+    if (traceRecorder_)
+        traceRecorder_->RecordRemoveObject(handle);
+
+    const unsigned slotIndex = (static_cast<unsigned>(handle) & HitHandleSlotMask) - 1;
+    HitObjectSlot& slot = hitObjects_[slotIndex];
+    slot.object_ = nullptr;
+
+    // Slot is retired when its generation is exhausted, so handles never repeat
+    if (slot.generation_ < HitHandleGenerationMask)
+    {
+        ++slot.generation_;
+        freeHitObjects_.push_back(slotIndex);
+    }
+}
+
+ea::span<const HitReference> HitManager::GetHitsByTrigger(const HitOwner* triggerOwner) const
+{
+    const auto iter = hitsByTrigger_.find(triggerOwner);
+    return iter != hitsByTrigger_.end() ? ea::span<const HitReference>{iter->second} : ea::span<const HitReference>{};
+}
+
+ea::span<const HitReference> HitManager::GetHitsByGroup(HitGroupId groupId) const
+{
+    const auto iter = hitsByGroup_.find(groupId);
+    return iter != hitsByGroup_.end() ? ea::span<const HitReference>{iter->second} : ea::span<const HitReference>{};
+}
+
+ea::span<const HitReference> HitManager::GetHitsByPair(const HitOwner* detectorOwner, const HitOwner* triggerOwner) const
+{
+    const auto iter = hitsByPair_.find(OwnerPairKey{detectorOwner, triggerOwner});
+    return iter != hitsByPair_.end() ? ea::span<const HitReference>{iter->second} : ea::span<const HitReference>{};
+}
+
+const GroupHitInfo* HitManager::GetHitInfo(const HitReference& hit) const
+{
+    return hit.detector_ ? hit.detector_->GetHitInfo(hit.id_) : nullptr;
+}
+
+void HitManager::IndexHitEvent(HitOwner* owner, const HitEvent& event)
+{
+    const HitReference reference{owner, event.hit_.id_};
+    if (event.eventType_ == E_HITSTARTED)
+        AddIndexedHit(reference, event.hit_);
+    else
+        RemoveIndexedHit(reference);
+}
+
+void HitManager::AddIndexedHit(const HitReference& reference, const GroupHitInfo& hit)
+{
+    if (!indexedHitIndex_.Insert(reference, indexedHits_.size()).second)
+        return;
+
+    const HitOwner* triggerOwner = hit.trigger_.Get();
+    indexedHits_.push_back(IndexedHit{reference, triggerOwner, hit.detectorGroupId_, hit.triggerGroupId_});
+
+    const auto addToBucket = [&](ea::vector<HitReference>& bucket)
+    {
+        bucket.push_back(reference);
+        return static_cast<unsigned>(bucket.size() - 1);
+    };
+
+    IndexedHit& indexedHit = indexedHits_.back();
+    indexedHit.triggerIndex_ = addToBucket(hitsByTrigger_[triggerOwner]);
+    indexedHit.detectorGroupIndex_ = addToBucket(hitsByGroup_[hit.detectorGroupId_]);
+    if (hit.triggerGroupId_ != hit.detectorGroupId_)
+        indexedHit.triggerGroupIndex_ = addToBucket(hitsByGroup_[hit.triggerGroupId_]);
+    indexedHit.pairIndex_ = addToBucket(hitsByPair_[OwnerPairKey{reference.detector_, triggerOwner}]);
+}
+
+void HitManager::RemoveIndexedHit(const HitReference& reference)
+{
+    const unsigned hitIndex = indexedHitIndex_.Find(reference);
+    if (hitIndex == M_MAX_UNSIGNED)
+        return;
+
+    const IndexedHit indexedHit = indexedHits_[hitIndex];
+    indexedHitIndex_.Erase(reference);
+    if (hitIndex + 1 != indexedHits_.size())
+    {
+        indexedHits_[hitIndex] = indexedHits_.back();
+        indexedHitIndex_.Set(indexedHits_[hitIndex].reference_, hitIndex);
+    }
+    indexedHits_.pop_back();
+
+    // Order of hits in the index is not preserved, last hit of the bucket takes place of the removed one
+    const auto removeFromBucket = [&](auto& index, const auto& key, unsigned position, const auto& getPosition)
+    {
+        const auto iterBucket = index.find(key);
+        if (iterBucket == index.end())
+            return;
+
+        ea::vector<HitReference>& bucket = iterBucket->second;
+        if (position + 1 < bucket.size())
+        {
+            bucket[position] = bucket.back();
+            getPosition(indexedHits_[indexedHitIndex_.Find(bucket[position])]) = position;
+        }
+        bucket.pop_back();
+
+        if (bucket.empty())
+            index.erase(iterBucket);
+    };
+
+    const auto triggerPosition = [](IndexedHit& hit) -> unsigned& { return hit.triggerIndex_; };
+    const auto pairPosition = [](IndexedHit& hit) -> unsigned& { return hit.pairIndex_; };
+    const auto groupPosition = [](HitGroupId groupId)
+    {
+        return [groupId](IndexedHit& hit) -> unsigned&
+        { return hit.detectorGroup_ == groupId ? hit.detectorGroupIndex_ : hit.triggerGroupIndex_; };
+    };
+
+    removeFromBucket(hitsByTrigger_, indexedHit.trigger_, indexedHit.triggerIndex_, triggerPosition);
+    removeFromBucket(hitsByGroup_, indexedHit.detectorGroup_, indexedHit.detectorGroupIndex_,
+        groupPosition(indexedHit.detectorGroup_));
+    if (indexedHit.triggerGroup_ != indexedHit.detectorGroup_)
+    {
+        removeFromBucket(hitsByGroup_, indexedHit.triggerGroup_, indexedHit.triggerGroupIndex_,
+            groupPosition(indexedHit.triggerGroup_));
+    }
+    removeFromBucket(
+        hitsByPair_, OwnerPairKey{reference.detector_, indexedHit.trigger_}, indexedHit.pairIndex_, pairPosition);
+}
+
+void HitManager::RemoveIndexedHitsOfOwner(HitOwner* owner)
+{
+    // Hits of removed owner are never stopped, and hits triggered by it will be stopped with null trigger
+    for (const GroupHitInfo& hit : owner->GetHits())
+        RemoveIndexedHit(HitReference{owner, hit.id_});
+
+    const auto iter = hitsByTrigger_.find(owner);
+    if (iter != hitsByTrigger_.end())
+    {
+        const ea::vector<HitReference> triggeredHits = iter->second;
+        for (const HitReference& reference : triggeredHits)
+            RemoveIndexedHit(reference);
+    }
+}
+
+void HitManager::ScheduleHitExpiration(HitOwner* owner, HitId id, double expirationTime)
+{
+    const WeakPtr<HitOwner> weakOwner{owner};
+    hitExpirations_.push_back(HitExpiration{expirationTime, weakOwner, id});
+    ea::push_heap(hitExpirations_.begin(), hitExpirations_.end());
+}
+
+void HitManager::ExpireFadingHits()
+{
+    if (hitExpirations_.empty() || hitExpirations_.front().expirationTime_ > elapsedTime_)
+        return;
+
+    URHO3D_PROFILE("Expire Fading Hits");
+
+    while (!hitExpirations_.empty() && hitExpirations_.front().expirationTime_ <= elapsedTime_)
+    {
+        ea::pop_heap(hitExpirations_.begin(), hitExpirations_.end());
+        const HitExpiration expiration = hitExpirations_.back();
+        hitExpirations_.pop_back();
+
+        // Owner may be destroyed or moved to another scene since expiration was scheduled
+        HitOwner* owner = expiration.owner_;
+        if (!owner || owner->GetRegistry() != this)
+            continue;
+
+        BeginOwnerStep();
+        owner->ExpireFadingHit(expiration.id_, expiration.expirationTime_, statistics_);
+        owner->SendPendingEvents(statistics_);
+    }
+}
+
+void HitManager::BeginOwnerStep()
+{
+    if (traceRecorder_)
+        traceRecorder_->RecordOwnerStep();
+    if (traceReplayer_)
+        traceReplayer_->ReplayOwnerStep();
+}
+
+void HitManager::SaveSnapshot(ea::vector<unsigned char>& buffer)
+{
+    URHO3D_PROFILE("Save Hit Snapshot");
+
+    buffer.clear();
+    HitSnapshotWriter writer{buffer};
+    writer.Write(hitSnapshotMagic);
+    writer.Write(hitSnapshotVersion);
+    writer.Write(frameIndex_);
+    writer.Write(elapsedTime_);
+
+    // Owners without hits are skipped, restore clears state of all owners anyway
+    const unsigned numOwnersOffset = writer.GetSize();
+    writer.Write(0u);
+    unsigned numOwners = 0;
+    for (TrackedComponentBase* baseComponent : GetTrackedComponents())
+    {
+        const auto owner = static_cast<HitOwner*>(baseComponent);
+        if (!owner->HasHitState())
+            continue;
+
+        writer.Write(owner->GetHitHandle());
+        const unsigned sizeOffset = writer.GetSize();
+        writer.Write(0u);
+        owner->SaveSnapshot(writer);
+        writer.WriteAt(sizeOffset, writer.GetSize() - sizeOffset - static_cast<unsigned>(sizeof(unsigned)));
+        ++numOwners;
+    }
+    writer.WriteAt(numOwnersOffset, numOwners);
+
+    const unsigned numExpirationsOffset = writer.GetSize();
+    writer.Write(0u);
+    unsigned numExpirations = 0;
+    for (const HitExpiration& expiration : hitExpirations_)
+    {
+        HitOwner* owner = expiration.owner_;
+        if (!owner || owner->GetRegistry() != this)
+            continue;
+
+        writer.Write(expiration.expirationTime_);
+        writer.Write(owner->GetHitHandle());
+        writer.Write(expiration.id_);
+        ++numExpirations;
+    }
+    writer.WriteAt(numExpirationsOffset, numExpirations);
+
+    // Broadphase and continuous triggers compare the next update with the previous one
+    const unsigned numPairs = broadphase_.GetNumPairs();
+    writer.Write(numPairs);
+    for (unsigned index = 0; index < numPairs; ++index)
+    {
+        writer.Write(broadphase_.GetPairDetector(index)->GetHitHandle());
+        writer.Write(broadphase_.GetPairTrigger(index)->GetHitHandle());
+    }
+
+    const unsigned numContinuousOffset = writer.GetSize();
+    writer.Write(0u);
+    unsigned numContinuous = 0;
+    for (const ContinuousTrigger& entry : continuousTriggers_)
+    {
+        HitTrigger* trigger = entry.trigger_;
+        if (!trigger || !entry.previousCenter_)
+            continue;
+
+        writer.Write(trigger->GetHitHandle());
+        writer.Write(entry.previousCenter_->x_);
+        writer.Write(entry.previousCenter_->y_);
+        writer.Write(entry.previousCenter_->z_);
+        ++numContinuous;
+    }
+    writer.WriteAt(numContinuousOffset, numContinuous);
+}
+
+bool HitManager::RestoreSnapshot(ea::span<const unsigned char> buffer)
+{
+    URHO3D_PROFILE("Restore Hit Snapshot");
+
+    // Queued events belong to the state being replaced, so they are delivered before it is cleared
+    DispatchQueuedEvents(true);
+    ClearAllHits();
+
+    const auto fail = [this]()
+    {
+        URHO3D_LOGERROR("Cannot restore hit snapshot: data is invalid or incompatible");
+        ClearAllHits();
+        return false;
+    };
+
+    HitSnapshotReader reader{buffer};
+    unsigned magic{};
+    unsigned version{};
+    if (!reader.Read(magic) || magic != hitSnapshotMagic || !reader.Read(version) || version != hitSnapshotVersion)
+        return fail();
+
+    unsigned frameIndex{};
+    double elapsedTime{};
+    unsigned numOwners{};
+    if (!reader.Read(frameIndex) || !reader.Read(elapsedTime) || !reader.Read(numOwners))
+        return fail();
+
+    for (unsigned index = 0; index < numOwners; ++index)
+    {
+        HitHandle handle{};
+        unsigned size{};
+        if (!reader.Read(handle) || !reader.Read(size))
+            return fail();
+
+        // Owner was destroyed since snapshot was taken
+        HitOwner* owner = GetHitObject<HitOwner>(handle);
+        if (!owner)
+        {
+            if (!reader.Skip(size))
+                return fail();
+            continue;
+        }
+
+        const unsigned endOffset = reader.GetOffset() + size;
+        if (!owner->RestoreSnapshot(reader) || reader.GetOffset() != endOffset)
+            return fail();
+    }
+
+    unsigned numExpirations{};
+    if (!reader.Read(numExpirations))
+        return fail();
+
+    for (unsigned index = 0; index < numExpirations; ++index)
+    {
+        double expirationTime{};
+        HitHandle handle{};
+        HitId id{};
+        if (!reader.Read(expirationTime) || !reader.Read(handle) || !reader.Read(id))
+            return fail();
+
+        if (HitOwner* owner = GetHitObject<HitOwner>(handle))
+            hitExpirations_.push_back(HitExpiration{expirationTime, WeakPtr<HitOwner>{owner}, id});
+    }
+    ea::make_heap(hitExpirations_.begin(), hitExpirations_.end());
+
+    unsigned numPairs{};
+    if (!reader.Read(numPairs))
+        return fail();
+
+    for (unsigned index = 0; index < numPairs; ++index)
+    {
+        HitHandle detectorHandle{};
+        HitHandle triggerHandle{};
+        if (!reader.Read(detectorHandle) || !reader.Read(triggerHandle))
+            return fail();
+
+        const auto detector = GetHitObject<HitDetector>(detectorHandle);
+        const auto trigger = GetHitObject<HitTrigger>(triggerHandle);
+        if (detector && trigger)
+            broadphase_.RestorePair(detector, trigger);
+    }
+    broadphase_.SortPairs();
+
+    // Continuous triggers missing in snapshot are not swept until they have previous position
+    for (ContinuousTrigger& entry : continuousTriggers_)
+        entry.previousCenter_ = ea::nullopt;
+
+    unsigned numContinuous{};
+    if (!reader.Read(numContinuous))
+        return fail();
+
+    for (unsigned index = 0; index < numContinuous; ++index)
+    {
+        HitHandle handle{};
+        Vector3 center;
+        if (!reader.Read(handle) || !reader.Read(center.x_) || !reader.Read(center.y_) || !reader.Read(center.z_))
+            return fail();
+
+        const auto trigger = GetHitObject<HitTrigger>(handle);
+        const auto isSameTrigger = [&](const ContinuousTrigger& entry) { return entry.trigger_ == trigger; };
+        const auto iter = ea::find_if(continuousTriggers_.begin(), continuousTriggers_.end(), isSameTrigger);
+        if (trigger && iter != continuousTriggers_.end())
+            iter->previousCenter_ = center;
+    }
+
+    frameIndex_ = frameIndex;
+    elapsedTime_ = elapsedTime;
+
+    for (TrackedComponentBase* baseComponent : GetTrackedComponents())
+    {
+        const auto owner = static_cast<HitOwner*>(baseComponent);
+        if (!owner->IsIdle())
+            ScheduleUpdate(owner);
+    }
+
+    RebuildIndexedHits();
+    return true;
+}
+
+void HitManager::ClearAllHits()
+{
+    for (TrackedComponentBase* baseComponent : GetTrackedComponents())
+        static_cast<HitOwner*>(baseComponent)->ClearHitState();
+
+    ClearScheduledOwners();
+    hitExpirations_.clear();
+    ClearIndexedHits();
+    ClearDispatchQueue();
+
+    // Raw hits are gone, so overlaps should be reported again on the next update
+    broadphase_.ClearPairs();
+}
+
+void HitManager::ClearIndexedHits()
+{
+    indexedHitIndex_.Reset(0);
+    indexedHits_.clear();
+    ClearBuckets(hitsByTrigger_);
+    ClearBuckets(hitsByGroup_);
+    ClearBuckets(hitsByPair_);
+}
+
+void HitManager::RebuildIndexedHits()
+{
+    const auto owners = StaticCastSpan<HitOwner*>(GetTrackedComponents());
+
+    // Index keeps its storage, so it is reset to the final size before hits are added
+    unsigned numHits = 0;
+    for (HitOwner* owner : owners)
+        numHits += owner->GetHits().size();
+    indexedHitIndex_.Reset(numHits);
+
+    for (HitOwner* owner : owners)
+    {
+        for (const GroupHitInfo& hit : owner->GetHits())
+            AddIndexedHit(HitReference{owner, hit.id_}, hit);
+    }
+
+    RemoveEmptyBuckets(hitsByTrigger_);
+    RemoveEmptyBuckets(hitsByGroup_);
+    RemoveEmptyBuckets(hitsByPair_);
+}
+
+bool HitManager::StartTraceRecording(const ea::string& fileName)
+{
+    StopTraceRecording();
+
+    auto file = MakeShared<File>(context_, fileName, FILE_WRITE);
+    if (!file->IsOpen())
+    {
+        URHO3D_LOGERROR("Cannot open hit trace '{}' for writing", fileName);
+        return false;
+    }
+
+    traceRecorder_ = ea::make_unique<HitTraceRecorder>(this, file);
+    for (TrackedComponentBase* baseComponent : GetTrackedComponents())
+        static_cast<HitOwner*>(baseComponent)->RecordTrace(*traceRecorder_);
+    return true;
+}
+
+void HitManager::StopTraceRecording()
+{
+    traceRecorder_.reset();
+}
+
+void HitManager::SetReplicationMode(HitReplicationMode mode)
+{
+    replicationMode_ = mode;
+    replicatedEvents_.clear();
+    numReplicatedGroups_ = 0;
+    serverGroupIds_.clear();
+}
+
+HitManager::ReplicatedHitEvent HitManager::MakeReplicatedEvent(bool isStarted, const GroupHitInfo& hit)
+{
+    return ReplicatedHitEvent{isStarted, GetOwnerNodeId(hit.detector_.Get()), GetOwnerNodeId(hit.trigger_.Get()),
+        hit.detectorGroupId_, hit.triggerGroupId_, hit.id_};
+}
+
+void HitManager::ReplicateHitEvent(const HitEvent& event)
+{
+    if (replicationMode_ != HitReplicationMode::Server)
+        return;
+
+    // Events are buffered until the next delta, buffer is dropped if delta is not written for too long
+    if (replicatedEvents_.size() >= MaxReplicatedEvents)
+    {
+        URHO3D_LOGWARNING("Replicated hit events are dropped because WriteReplicationDelta is not called");
+        replicatedEvents_.clear();
+    }
+
+    replicatedEvents_.push_back(MakeReplicatedEvent(event.eventType_ == E_HITSTARTED, event.hit_));
+}
+
+void HitManager::WriteReplicationDelta(ea::vector<unsigned char>& buffer)
+{
+    URHO3D_PROFILE("Write Hit Replication Delta");
+
+    buffer.clear();
+    HitBitWriter writer{buffer};
+    WriteReplicationData(writer, numReplicatedGroups_, replicatedEvents_);
+
+    numReplicatedGroups_ = groupNames_.size();
+    replicatedEvents_.clear();
+}
+
+void HitManager::WriteReplicationBaseline(ea::vector<unsigned char>& buffer)
+{
+    URHO3D_PROFILE("Write Hit Replication Baseline");
+
+    baselineEvents_.clear();
+    for (TrackedComponentBase* baseComponent : GetTrackedComponents())
+    {
+        const auto owner = static_cast<HitOwner*>(baseComponent);
+        for (const GroupHitInfo& hit : owner->GetHits())
+            baselineEvents_.push_back(MakeReplicatedEvent(true, hit));
+    }
+
+    buffer.clear();
+    HitBitWriter writer{buffer};
+    WriteReplicationData(writer, 0, baselineEvents_);
+}
+
+void HitManager::WriteReplicationData(
+    HitBitWriter& writer, unsigned firstGroup, ea::span<const ReplicatedHitEvent> events) const
+{
+    // Groups are only added, so client can extend its table with names it has not seen yet
+    const unsigned numGroups = groupNames_.size();
+    writer.WriteVarUInt(firstGroup);
+    writer.WriteVarUInt(numGroups - firstGroup);
+    for (unsigned index = firstGroup; index < numGroups; ++index)
+        writer.WriteString(groupNames_[index]);
+
+    // Owners of consecutive events are often neighbours, so node IDs are delta-encoded
+    writer.WriteVarUInt(events.size());
+    unsigned previousDetectorNode = 0;
+    for (const ReplicatedHitEvent& event : events)
+    {
+        const auto id = static_cast<unsigned>(event.id_);
+        writer.WriteBool(event.isStarted_);
+        writer.WriteVarInt(static_cast<int>(event.detectorNode_ - previousDetectorNode));
+        writer.WriteVarUInt(id & ReplicatedHitIdLowMask);
+        writer.WriteVarUInt(id >> ReplicatedHitIdLowBits);
+        if (event.isStarted_)
+        {
+            writer.WriteVarInt(static_cast<int>(event.triggerNode_ - event.detectorNode_));
+            writer.WriteVarUInt(static_cast<unsigned>(event.detectorGroup_));
+            writer.WriteVarUInt(static_cast<unsigned>(event.triggerGroup_));
+        }
+        previousDetectorNode = event.detectorNode_;
+    }
+}
+
+bool HitManager::ApplyReplicationData(ea::span<const unsigned char> buffer)
+{
+    URHO3D_PROFILE("Apply Hit Replication Data");
+
+    Scene* scene = GetScene();
+    if (!scene || replicationMode_ != HitReplicationMode::Client)
+    {
+        URHO3D_LOGERROR("Hit replication data can be applied only by client HitManager in scene");
+        return false;
+    }
+
+    const auto fail = []()
+    {
+        URHO3D_LOGERROR("Cannot apply hit replication data: data is invalid or received out of order");
+        return false;
+    };
+
+    HitBitReader reader{buffer};
+    unsigned firstGroup{};
+    unsigned numGroups{};
+    if (!reader.ReadVarUInt(firstGroup) || !reader.ReadVarUInt(numGroups) || firstGroup > serverGroupIds_.size())
+        return fail();
+
+    for (unsigned index = 0; index < numGroups; ++index)
+    {
+        if (!reader.ReadString(tempGroupName_))
+            return fail();
+
+        const unsigned serverGroup = firstGroup + index;
+        const HitGroupId groupId = GetOrAddGroup(tempGroupName_);
+        if (serverGroup < serverGroupIds_.size())
+            serverGroupIds_[serverGroup] = groupId;
+        else
+            serverGroupIds_.push_back(groupId);
+    }
+
+    unsigned numEvents{};
+    if (!reader.ReadVarUInt(numEvents))
+        return fail();
+
+    unsigned detectorNode = 0;
+    for (unsigned index = 0; index < numEvents; ++index)
+    {
+        bool isStarted{};
+        int detectorNodeOffset{};
+        unsigned idLow{};
+        unsigned idHigh{};
+        if (!reader.ReadBool(isStarted) || !reader.ReadVarInt(detectorNodeOffset) || !reader.ReadVarUInt(idLow)
+            || !reader.ReadVarUInt(idHigh) || idLow > ReplicatedHitIdLowMask)
+            return fail();
+
+        detectorNode += static_cast<unsigned>(detectorNodeOffset);
+        const auto id = static_cast<HitId>((idHigh << ReplicatedHitIdLowBits) | idLow);
+        HitOwner* owner = FindOwnerByNodeId(scene, detectorNode);
+        if (owner && owner->GetRegistry() != this)
+            owner = nullptr;
+
+        if (isStarted)
+        {
+            int triggerNodeOffset{};
+            unsigned detectorGroup{};
+            unsigned triggerGroup{};
+            if (!reader.ReadVarInt(triggerNodeOffset) || !reader.ReadVarUInt(detectorGroup)
+                || !reader.ReadVarUInt(triggerGroup) || detectorGroup >= serverGroupIds_.size()
+                || triggerGroup >= serverGroupIds_.size())
+                return fail();
+
+            if (!owner)
+                continue;
+
+            const unsigned triggerNode = detectorNode + static_cast<unsigned>(triggerNodeOffset);
+            HitOwner* triggerOwner = FindOwnerByNodeId(scene, triggerNode);
+            const HitHandle triggerHandle =
+                triggerOwner && triggerOwner->GetRegistry() == this ? triggerOwner->GetHitHandle() : HitHandle::Invalid;
+
+            owner->AddReplicatedHit(HitRecord{owner->GetHitHandle(), triggerHandle, serverGroupIds_[detectorGroup],
+                serverGroupIds_[triggerGroup], id, frameIndex_});
+        }
+        else if (owner)
+            owner->RemoveReplicatedHit(id);
+
+        if (owner)
+            owner->SendPendingEvents(statistics_);
+    }
+
+    return true;
+}
+
+bool HitManager::QueueHitEvent(const HitEvent& event)
+{
+    if (dispatchQueue_.empty() && !IsDispatchBudgetEnabled())
+        return false;
+
+    const HitReference reference{event.hit_.detector_.Get(), event.hit_.id_};
+    const HitDispatchPriority priority = ea::max(
+        GetGroupDispatchPriority(event.hit_.detectorGroupId_), GetGroupDispatchPriority(event.hit_.triggerGroupId_));
+
+    // Hit with queued events stays in the queue even if budget is disabled or priority is changed
+    const auto iter = queuedHits_.find(reference);
+    if (iter == queuedHits_.end() && (priority == HitDispatchPriority::Immediate || !IsDispatchBudgetEnabled()))
+        return false;
+
+    QueuedHit& queuedHit = iter != queuedHits_.end() ? iter->second : queuedHits_[reference];
+    queuedHit.priority_ = queuedHit.numEvents_ > 0 ? ea::min(queuedHit.priority_, priority) : priority;
+    ++queuedHit.numEvents_;
+
+    dispatchQueue_.push_back(QueuedHitEvent{queuedHit.priority_, nextDispatchSequence_++, reference, event});
+    ea::push_heap(dispatchQueue_.begin(), dispatchQueue_.end());
+    return true;
+}
+
+void HitManager::DispatchQueuedEvents(bool ignoreBudget)
+{
+    if (dispatchQueue_.empty())
+        return;
+
+    URHO3D_PROFILE("Dispatch Queued Hit Events");
+
+    HiresTimer timer;
+    const unsigned maxEvents = ignoreBudget ? 0 : maxDispatchedEvents_;
+    const long long timeBudget = ignoreBudget ? 0 : static_cast<long long>(dispatchTimeBudget_ * 1000.0f);
+    unsigned numDispatched = 0;
+    while (!dispatchQueue_.empty())
+    {
+        if (maxEvents != 0 && numDispatched >= maxEvents)
+            break;
+        if (timeBudget > 0 && numDispatched > 0 && timer.GetUSec(false) >= timeBudget)
+            break;
+
+        ea::pop_heap(dispatchQueue_.begin(), dispatchQueue_.end());
+        const HitReference reference = dispatchQueue_.back().reference_;
+        const HitEvent event = ea::move(dispatchQueue_.back().event_);
+        dispatchQueue_.pop_back();
+        ++numDispatched;
+
+        const auto iter = queuedHits_.find(reference);
+        if (iter != queuedHits_.end() && --iter->second.numEvents_ == 0)
+            queuedHits_.erase(iter);
+
+        // Owner may be destroyed while event was queued, global listeners are notified anyway
+        HitOwner* owner = event.hit_.detector_;
+        if (owner && owner->GetRegistry() == this)
+        {
+            owner->DispatchEvent(event, statistics_);
+            continue;
+        }
+
+        if (!listeners_.IsEmpty())
+        {
+            if (event.eventType_ == E_HITSTARTED)
+                listeners_.NotifyHitStarted(event.hit_);
+            else
+                listeners_.NotifyHitStopped(event.hit_);
+        }
+        if (sendBatchedEvents_)
+            AddBatchedEvent(event);
+        ++statistics_.numEventsDispatched_;
+    }
+
+    statistics_.numEventsQueued_ = dispatchQueue_.size();
+}
+
+void HitManager::ClearDispatchQueue()
+{
+    dispatchQueue_.clear();
+    queuedHits_.clear();
+}
+
+RigidBody* HitManager::AcquireRigidBody(HitComponent* component)
+{
+    PoolReleasedBodies();
+
+    SharedPtr<RigidBody> rigidBody;
+    const bool isRecycled = !bodyPool_.empty();
+    if (isRecycled)
+    {
+        rigidBody = bodyPool_.back();
+        bodyPool_.pop_back();
+    }
+    else
+        rigidBody = MakeShared<RigidBody>(context_);
+
+    // Detached body is not in physics world, so configuration does not cause re-insertion
+    component->SetupRigidBody(this, rigidBody);
+    rigidBody->SetLinearVelocity(Vector3::ZERO);
+    rigidBody->SetAngularVelocity(Vector3::ZERO);
+
+    Node* node = component->GetNode();
+    node->AddComponent(rigidBody, 0);
+
+    // New body collects shapes of the node when it is added to the world, recycled body should be notified
+    if (isRecycled)
+    {
+        node->GetComponents<CollisionShape>(tempCollisionShapes_);
+        for (CollisionShape* collisionShape : tempCollisionShapes_)
+            collisionShape->NotifyRigidBody(false);
+        tempCollisionShapes_.clear();
+        rigidBody->UpdateMass();
+    }
+
+    return rigidBody;
+}
+
+void HitManager::ReleaseRigidBody(RigidBody* rigidBody)
+{
+    releasedBodies_.emplace_back(rigidBody);
+}
+
+void HitManager::PoolReleasedBodies()
+{
+    for (const SharedPtr<RigidBody>& body : releasedBodies_)
+    {
+        // Collision shapes of the node outlive the body if only hit component is removed.
+        // They still reference the body, so it is removed from the node and not reused
+        if (body->GetNode())
+        {
+            body->Remove();
+            continue;
+        }
+
+        if (bodyPool_.size() < maxPooledBodies_)
+            bodyPool_.push_back(body);
+    }
+    releasedBodies_.clear();
+}
+
+void HitManager::ReserveRigidBodies(unsigned count)
+{
+    while (bodyPool_.size() < count)
+        bodyPool_.push_back(MakeShared<RigidBody>(context_));
+}
+
+void HitManager::AddBodyComponent(RigidBody* rigidBody, HitComponent* component)
+{
+    HitBody& hitBody = hitBodies_[rigidBody];
+    if (hitBody.body_ != rigidBody)
+    {
+        // Entry left by destroyed body at the same address is stale
+        hitBody = HitBody{};
+        hitBody.body_ = rigidBody;
+    }
+
+    if (component->IsInstanceOf<HitDetector>())
+    {
+        const auto detector = static_cast<HitDetector*>(component);
+        if (ea::find(hitBody.detectors_.begin(), hitBody.detectors_.end(), detector) == hitBody.detectors_.end())
+            hitBody.detectors_.push_back(detector);
+        detectorBodyLayers_ |= rigidBody->GetCollisionLayer();
+    }
+    else if (component->IsInstanceOf<HitTrigger>())
+    {
+        // Only one trigger per body is used, same as lookup of the first HitTrigger in the node
+        if (!hitBody.trigger_)
+            hitBody.trigger_ = static_cast<HitTrigger*>(component);
+        triggerBodyLayers_ |= rigidBody->GetCollisionLayer();
+    }
+}
+
+void HitManager::RemoveBodyComponent(const RigidBody* rigidBody, HitComponent* component)
+{
+    const auto iter = hitBodies_.find(rigidBody);
+    if (iter == hitBodies_.end())
+        return;
+
+    HitBody& hitBody = iter->second;
+    ea::erase(hitBody.detectors_, component);
+    if (hitBody.trigger_ == component)
+        hitBody.trigger_ = nullptr;
+
+    if (hitBody.detectors_.empty() && !hitBody.trigger_)
+        hitBodies_.erase(iter);
+}
+
+const HitManager::HitBody* HitManager::FindHitBody(const RigidBody* rigidBody)
+{
+    const auto iter = hitBodies_.find(rigidBody);
+    if (iter == hitBodies_.end())
+        return nullptr;
+
+    // Body may be removed while its hit components stay alive, so the key may be reused by another body
+    if (iter->second.body_ != rigidBody)
+    {
+        hitBodies_.erase(iter);
+        return nullptr;
+    }
+    return &iter->second;
+}
+
+void HitManager::AddContinuousTrigger(HitTrigger* trigger)
+{
+    const auto isSameTrigger = [&](const ContinuousTrigger& entry) { return entry.trigger_ == trigger; };
+    if (ea::find_if(continuousTriggers_.begin(), continuousTriggers_.end(), isSameTrigger) != continuousTriggers_.end())
+        return;
+
+    const WeakPtr<HitTrigger> weakTrigger{trigger};
+    continuousTriggers_.push_back(ContinuousTrigger{weakTrigger});
+}
+
+void HitManager::SweepContinuousTriggers()
+{
+    if (continuousTriggers_.empty())
+        return;
+
+    URHO3D_PROFILE("Sweep Continuous Triggers");
+
+    ea::erase_if(continuousTriggers_,
+        [](const ContinuousTrigger& entry)
+    {
+        HitTrigger* trigger = entry.trigger_;
+        return !trigger || !trigger->IsContinuous() || trigger->GetBroadphaseIndex() == M_MAX_UNSIGNED;
+    });
+
+    for (ContinuousTrigger& entry : continuousTriggers_)
+    {
+        HitTrigger* trigger = entry.trigger_;
+        const HitShape* shape = broadphase_.GetShape(trigger);
+
+        // Disabled triggers are not swept, so teleporting a disabled trigger does not produce hits
+        const ea::optional<Vector3> previousCenter = entry.previousCenter_;
+        entry.previousCenter_ = trigger->IsSelfAndOwnerEnabled() ? ea::optional<Vector3>{shape->GetCenter()} : ea::nullopt;
+        if (!previousCenter || !entry.previousCenter_)
+            continue;
+
+        const Vector3 offset = *entry.previousCenter_ - *previousCenter;
+        if (offset.LengthSquared() < M_EPSILON * M_EPSILON)
+            continue;
+
+        sweptDetectors_.clear();
+        broadphase_.QueryDetectors(HitShape::CreateSweep(*shape, *previousCenter), sweptDetectors_);
+        for (HitDetector* detector : sweptDetectors_)
+            detector->OnHitSwept(trigger);
+    }
+}
+
+void HitManager::UpdateComponentStates(ea::span<HitOwner* const> owners)
+{
+    URHO3D_PROFILE("Update Hit Component States");
+
+    for (HitOwner* owner : owners)
+    {
+        if (owner)
+            owner->PrepareUpdate(evaluationIndex_);
+    }
+}
+
+void HitManager::UpdateOwnersInParallel()
+{
+    URHO3D_PROFILE("Update Hits In Parallel");
+
+    // Owners scheduled by event handlers are processed on the next frame
+    const unsigned numOwners = scheduledOwners_.size();
+    const ea::span<HitOwner* const> owners{scheduledOwners_.data(), numOwners};
+
+    // Shared component state is evaluated before worker threads start reading it
+    UpdateComponentStates(owners);
+
+    auto workQueue = GetSubsystem<WorkQueue>();
+    threadStatistics_.clear();
+    threadStatistics_.resize(workQueue->GetNumProcessingThreads());
+
+    ForEachParallel(workQueue, ParallelUpdateBatchSize, owners,
+        [&](unsigned /*index*/, HitOwner* owner)
+    {
+        if (owner)
+            owner->UpdateHits(threadStatistics_[WorkQueue::GetThreadIndex()]);
+    });
+
+    for (const HitStatistics& threadStatistics : threadStatistics_)
+        statistics_ += threadStatistics;
+
+    // Dispatch events in deterministic order regardless of thread scheduling
+    for (unsigned index = 0; index < numOwners; ++index)
+    {
+        if (HitOwner* owner = scheduledOwners_[index])
+        {
+            BeginOwnerStep();
+            owner->SendPendingEvents(statistics_);
+        }
+    }
 }
 
 } // namespace Urho3D
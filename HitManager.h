@@ -1,16 +1,30 @@
 #pragma once
 
-#include "_Plugin.h"
+#include "HitInfo.h"
+#include "HitShapes.h"
 
 #include <Urho3D/Scene/TrackedComponent.h>
 
+#include <EASTL/span.h>
+#include <EASTL/type_traits.h>
+#include <EASTL/unique_ptr.h>
+#include <EASTL/unordered_map.h>
+
+#include <cstring>
+
 namespace Urho3D
 {
 
-struct GroupHitInfo;
+class HitComponent;
 class HitDetector;
 class HitOwner;
 class HitTrigger;
+class HitBitWriter;
+class HitTraceRecorder;
+class HitTraceReplayer;
+class CollisionShape;
+class PhysicsWorld;
+class RigidBody;
 
 URHO3D_EVENT(E_HITSTARTED, HitStarted)
 {
@@ -30,6 +44,234 @@ URHO3D_EVENT(E_HITSTOPPED, HitStopped)
     URHO3D_PARAM(P_ID, Id); // int
 }
 
+/// Sent to the scene once per frame if batched events are enabled.
+/// Use HitManager::GetBatchedEvents to access hits started and stopped during the frame.
+URHO3D_EVENT(E_HITBATCH, HitBatch)
+{
+    URHO3D_PARAM(P_HITMANAGER, HitManager); // HitManager pointer
+    URHO3D_PARAM(P_NUMEVENTS, NumEvents); // int
+}
+
+/// Source of raw hits between detectors and triggers.
+enum class HitDetectionMode
+{
+    /// Each hit component has RigidBody and hits are reported by physics world.
+    Physics,
+    /// Hit components declare shapes and HitManager tests them for overlap without physics.
+    Shapes
+};
+
+/// When HitManager evaluates hits.
+enum class HitUpdateMode
+{
+    /// Hits are evaluated on every scene update.
+    SceneUpdate,
+    /// Hits are evaluated after scene update only if physics world made any steps since the previous evaluation.
+    /// All steps are coalesced into one evaluation. Contacts started and stopped between evaluations
+    /// are evaluated once, so they still produce start and stop of the hit.
+    /// Hits are evaluated after every scene update if scene has no PhysicsWorld, detection mode is Shapes
+    /// or replication mode is Client.
+    PhysicsStep
+};
+
+/// Role of HitManager in replication of hits over network.
+enum class HitReplicationMode
+{
+    /// Hits are detected locally and not replicated.
+    None,
+    /// Hits are detected locally, started and stopped hits are recorded for replication.
+    Server,
+    /// Hits are not detected locally and hit components don't need physics.
+    /// Hits are received from server via ApplyReplicationData.
+    Client
+};
+
+/// Priority of hit event delivery when dispatch budget of HitManager is enabled.
+/// Priority of a hit is the highest priority of its detector and trigger groups.
+enum class HitDispatchPriority : unsigned char
+{
+    /// Delivered within the budget after events of higher priority, may be delayed to later frames.
+    /// @{
+    Low,
+    Normal,
+    High,
+    /// @}
+    /// Delivered immediately regardless of the budget.
+    Immediate
+};
+
+/// Hit processing statistics of one frame.
+struct PLUGIN_CORE_HITMANAGER_API HitStatistics
+{
+    unsigned numOwnersProcessed_{};
+    unsigned numComponentHits_{};
+    unsigned numGroupHits_{};
+    unsigned numHitsStarted_{};
+    unsigned numHitsStopped_{};
+    /// Number of hits that stopped and started fading out.
+    unsigned numHitsFading_{};
+    unsigned numEventsDispatched_{};
+    /// Number of events left in dispatch queue at the end of the frame.
+    unsigned numEventsQueued_{};
+    /// Number of physics steps coalesced into the update, see HitUpdateMode::PhysicsStep.
+    unsigned numPhysicsSteps_{};
+
+    /// Time spent in each stage of HitOwner update, in microseconds.
+    /// Collected only if HitManager::SetCollectTimings is enabled.
+    /// @{
+    long long removeExpiredRawHitsTime_{};
+    long long calculateGroupHitsTime_{};
+    long long startAndStopHitsTime_{};
+    long long sendEventsTime_{};
+    /// @}
+
+    HitStatistics& operator+=(const HitStatistics& rhs);
+};
+
+/// Filter of hit enumeration. Default filter accepts all ongoing and fading hits.
+struct PLUGIN_CORE_HITMANAGER_API HitFilter
+{
+    ea::optional<HitGroupId> detectorGroup_;
+    ea::optional<HitGroupId> triggerGroup_;
+    const HitOwner* detector_{};
+    const HitOwner* trigger_{};
+    /// Accept only hits started in the last update.
+    bool startedThisFrame_{};
+    /// Accept only stopped hits waiting for fade out.
+    bool fadingOnly_{};
+
+    bool Matches(const GroupHitInfo& hit, unsigned frameIndex) const;
+};
+
+/// Cursor over hits of all owners in HitManager. Does not allocate.
+/// Owners and hits should not be modified while cursor is in use.
+class PLUGIN_CORE_HITMANAGER_API HitCursor
+{
+public:
+    HitCursor(HitManager* hitManager, const HitFilter& filter = {});
+
+    /// Return next matching hit or null if there are no more hits.
+    const GroupHitInfo* Next();
+
+private:
+    bool AdvanceOwner();
+
+    HitManager* hitManager_{};
+    HitFilter filter_;
+    unsigned frameIndex_{};
+
+    const HitOwner* owner_{};
+    unsigned ownerIndex_{};
+    unsigned hitIndex_{};
+    bool isFadingHits_{};
+};
+
+/// Native hit listener that receives hits without Variant conversions.
+/// Listener is not owned and should be removed before destruction.
+class PLUGIN_CORE_HITMANAGER_API HitListener
+{
+public:
+    virtual ~HitListener() = default;
+
+    virtual void OnHitStarted(const GroupHitInfo& hit) {}
+    virtual void OnHitStopped(const GroupHitInfo& hit) {}
+};
+
+/// List of hit listeners. Listeners may be safely added or removed from notification callbacks.
+class PLUGIN_CORE_HITMANAGER_API HitListenerList
+{
+public:
+    void Add(HitListener* listener);
+    void Remove(HitListener* listener);
+    bool IsEmpty() const { return numListeners_ == 0; }
+
+    void NotifyHitStarted(const GroupHitInfo& hit) { Notify(hit, &HitListener::OnHitStarted); }
+    void NotifyHitStopped(const GroupHitInfo& hit) { Notify(hit, &HitListener::OnHitStopped); }
+
+private:
+    void Notify(const GroupHitInfo& hit, void (HitListener::*callback)(const GroupHitInfo&));
+
+    /// Removed listeners are replaced with nulls and compacted after notification.
+    ea::vector<HitListener*> listeners_;
+    unsigned numListeners_{};
+    unsigned notificationDepth_{};
+};
+
+/// Appends trivially copyable values to flat snapshot buffer.
+class HitSnapshotWriter
+{
+public:
+    explicit HitSnapshotWriter(ea::vector<unsigned char>& buffer) : buffer_(buffer) {}
+
+    template <class T> void Write(const T& value)
+    {
+        static_assert(ea::is_trivially_copyable<T>::value, "Only trivially copyable types can be written");
+        const unsigned offset = buffer_.size();
+        buffer_.resize(offset + sizeof(T));
+        memcpy(buffer_.data() + offset, &value, sizeof(T));
+    }
+
+    template <class T> void WriteArray(const ea::vector<T>& values)
+    {
+        static_assert(ea::is_trivially_copyable<T>::value, "Only trivially copyable types can be written");
+        Write<unsigned>(values.size());
+        const unsigned offset = buffer_.size();
+        buffer_.resize(offset + sizeof(T) * values.size());
+        if (!values.empty())
+            memcpy(buffer_.data() + offset, values.data(), sizeof(T) * values.size());
+    }
+
+    unsigned GetSize() const { return buffer_.size(); }
+    /// Overwrite previously written value, used to write sizes of blocks.
+    template <class T> void WriteAt(unsigned offset, const T& value) { memcpy(buffer_.data() + offset, &value, sizeof(T)); }
+
+private:
+    ea::vector<unsigned char>& buffer_;
+};
+
+/// Reads values written by HitSnapshotWriter. Reading past the end fails and leaves value unchanged.
+class HitSnapshotReader
+{
+public:
+    explicit HitSnapshotReader(ea::span<const unsigned char> buffer) : buffer_(buffer) {}
+
+    template <class T> bool Read(T& value)
+    {
+        if (offset_ + sizeof(T) > buffer_.size())
+            return false;
+        memcpy(&value, buffer_.data() + offset_, sizeof(T));
+        offset_ += sizeof(T);
+        return true;
+    }
+
+    /// Read array into existing vector, reusing its capacity.
+    template <class T> bool ReadArray(ea::vector<T>& values)
+    {
+        unsigned size{};
+        if (!Read(size) || offset_ + sizeof(T) * size > buffer_.size())
+            return false;
+        values.resize(size);
+        if (size != 0)
+            memcpy(values.data(), buffer_.data() + offset_, sizeof(T) * size);
+        offset_ += sizeof(T) * size;
+        return true;
+    }
+
+    bool Skip(unsigned size)
+    {
+        if (offset_ + size > buffer_.size())
+            return false;
+        offset_ += size;
+        return true;
+    }
+
+    unsigned GetOffset() const { return offset_; }
+
+private:
+    ea::span<const unsigned char> buffer_;
+    unsigned offset_{};
+};
+
 class PLUGIN_CORE_HITMANAGER_API HitManager : public TrackedComponentRegistryBase
 {
     URHO3D_OBJECT(HitManager, TrackedComponentRegistryBase);
@@ -39,12 +281,114 @@ public:
     static constexpr unsigned DefaultDetectorCollisionLayer = 0x4000;
     static constexpr unsigned DefaultTriggerCollisionMask = DefaultDetectorCollisionLayer;
     static constexpr unsigned DefaultDetectorCollisionMask = DefaultTriggerCollisionLayer;
+    static constexpr unsigned ParallelUpdateBatchSize = 16;
+    static constexpr unsigned DefaultMaxPooledBodies = 256;
+    static constexpr unsigned MaxReplicatedEvents = 64 * 1024;
 
     HitManager(Context* context);
+    ~HitManager() override;
     static void RegisterObject(Context* context);
 
     /// Enumerate all active hits happening in the scene.
     void EnumerateActiveHits(ea::vector<const GroupHitInfo*>& hits);
+    /// Call callback(const GroupHitInfo&) for each ongoing or fading hit accepted by filter. Does not allocate.
+    template <class T> void ForEachActiveHit(const HitFilter& filter, const T& callback);
+
+    /// Add or remove listener of all hits in the scene.
+    /// @{
+    void AddListener(HitListener* listener) { listeners_.Add(listener); }
+    void RemoveListener(HitListener* listener) { listeners_.Remove(listener); }
+    HitListenerList& GetListeners() { return listeners_; }
+    /// @}
+
+    /// Return hits of trigger owner, hits involving group as either detector or trigger group,
+    /// and hits between detector and trigger owners. Includes fading hits.
+    /// Indices are updated when hits start and stop, before events are dispatched or queued.
+    /// Returned span is invalidated by the next hit start or stop.
+    /// @{
+    ea::span<const HitReference> GetHitsByTrigger(const HitOwner* triggerOwner) const;
+    ea::span<const HitReference> GetHitsByGroup(HitGroupId groupId) const;
+    ea::span<const HitReference> GetHitsByPair(const HitOwner* detectorOwner, const HitOwner* triggerOwner) const;
+    /// @}
+    /// Resolve hit reference. Returns null if hit is already stopped.
+    const GroupHitInfo* GetHitInfo(const HitReference& hit) const;
+    /// Call callback(const GroupHitInfo&) for each referenced hit. Spans from the functions above may be passed as is.
+    template <class T> void ForEachHit(ea::span<const HitReference> hits, const T& callback) const;
+
+    /// Intern group name. Group identifiers are stable for the lifetime of HitManager.
+    HitGroupId GetOrAddGroup(const ea::string& groupName);
+    /// Return name of interned group.
+    const ea::string& GetGroupName(HitGroupId groupId) const;
+
+    /// Allow or deny hits between detector group and trigger group. Pairs without rule use default policy.
+    /// Rules are checked when contact starts and on every update of the owner.
+    /// Contacts rejected on start are not tracked, so allowing them takes effect when contact restarts.
+    /// @{
+    void SetGroupPairAllowed(HitGroupId detectorGroup, HitGroupId triggerGroup, bool allowed);
+    void SetGroupPairAllowed(const ea::string& detectorGroup, const ea::string& triggerGroup, bool allowed);
+    void ResetGroupPairRules();
+    /// @}
+    /// Return whether hits between groups are allowed. Safe to call from worker threads during update.
+    bool IsGroupPairAllowed(HitGroupId detectorGroup, HitGroupId triggerGroup) const;
+    /// Return whether hit between owners is allowed by their team masks.
+    bool IsTeamPairAllowed(const HitOwner* detectorOwner, const HitOwner* triggerOwner) const;
+
+    /// Set dispatch priority of the group, see SetMaxDispatchedEvents and SetDispatchTimeBudget.
+    /// Groups are dispatched immediately by default.
+    /// @{
+    void SetGroupDispatchPriority(HitGroupId groupId, HitDispatchPriority priority);
+    void SetGroupDispatchPriority(const ea::string& groupName, HitDispatchPriority priority);
+    /// @}
+    HitDispatchPriority GetGroupDispatchPriority(HitGroupId groupId) const;
+
+    /// Return object referenced by handle, or null if it is destroyed or removed from the scene.
+    Component* GetHitObject(HitHandle handle) const;
+    template <class T> T* GetHitObject(HitHandle handle) const { return static_cast<T*>(GetHitObject(handle)); }
+    /// Create hit description from compact record.
+    GroupHitInfo MakeHitInfo(const HitRecord& record) const;
+
+    /// Internal.
+    /// @{
+    /// Register HitOwner or HitComponent in the table of handles. Handle should be removed before destruction.
+    HitHandle AddHitObject(Component* object);
+    void RemoveHitObject(HitHandle handle);
+    /// Update all scheduled owners. Called automatically on scene subsystem update.
+    void Update(float timeStep);
+    /// Schedule HitOwner for update. Owner is unscheduled automatically when it has no hits.
+    void ScheduleUpdate(HitOwner* owner);
+    /// Add or remove component with hit shape.
+    /// Shapes are used for detection if detection mode is Shapes, and by continuous triggers in any mode.
+    /// @{
+    void AddShapeComponent(HitComponent* component) { broadphase_.AddComponent(component); }
+    void RemoveShapeComponent(HitComponent* component, bool notifyStopped) { broadphase_.RemoveComponent(component, notifyStopped); }
+    /// @}
+    /// Return velocity of the component shape estimated from its movement during the last update.
+    Vector3 GetShapeVelocity(const HitComponent* component) const { return broadphase_.GetVelocity(component); }
+    /// Add or remove component using rigid body for detection. Collisions of the body are dispatched to the component.
+    /// @{
+    void AddBodyComponent(RigidBody* rigidBody, HitComponent* component);
+    void RemoveBodyComponent(const RigidBody* rigidBody, HitComponent* component);
+    /// @}
+    /// Create rigid body for the component from pool. Body is configured before it is added to the node,
+    /// so it is inserted into physics world once.
+    RigidBody* AcquireRigidBody(HitComponent* component);
+    /// Return rigid body to pool. Called when scene is modified, so body is handled on the next update
+    /// or acquisition. Body of the node that is still alive is removed from it instead of being pooled.
+    void ReleaseRigidBody(RigidBody* rigidBody);
+    /// Add trigger tested against detectors along its path between updates. Trigger is removed automatically
+    /// when it is destroyed, loses its shape or stops being continuous.
+    void AddContinuousTrigger(HitTrigger* trigger);
+    /// Schedule HitOwner::ExpireFadingHit call when elapsed time reaches expiration time.
+    void ScheduleHitExpiration(HitOwner* owner, HitId id, double expirationTime);
+    /// Update hit indices on dispatch of hit event.
+    void IndexHitEvent(HitOwner* owner, const HitEvent& event);
+    /// Add event to the batch sent at the end of the frame.
+    void AddBatchedEvent(const HitEvent& event) { batchedEvents_.push_back(event); }
+    /// Record dispatched event for replication if HitManager is server.
+    void ReplicateHitEvent(const HitEvent& event);
+    /// Queue event for dispatch within the budget. Returns false if event should be dispatched immediately.
+    bool QueueHitEvent(const HitEvent& event);
+    /// @}
 
     /// Attributes.
     /// @{
@@ -56,22 +400,346 @@ public:
     unsigned GetDetectorCollisionMask() const { return detectorCollisionMask_; }
     void SetDetectorCollisionLayer(unsigned collisionLayer) { detectorCollisionLayer_ = collisionLayer; }
     unsigned GetDetectorCollisionLayer() const { return detectorCollisionLayer_; }
+    void SetDetectionMode(HitDetectionMode mode) { detectionMode_ = mode; }
+    HitDetectionMode GetDetectionMode() const { return detectionMode_; }
+    void SetUpdateMode(HitUpdateMode mode);
+    HitUpdateMode GetUpdateMode() const { return updateMode_; }
+    void SetParallelUpdate(bool enabled) { parallelUpdate_ = enabled; }
+    bool IsParallelUpdate() const { return parallelUpdate_; }
+    void SetSendHitEvents(bool enabled) { sendHitEvents_ = enabled; }
+    bool GetSendHitEvents() const { return sendHitEvents_; }
+    void SetSendBatchedEvents(bool enabled) { sendBatchedEvents_ = enabled; }
+    bool GetSendBatchedEvents() const { return sendBatchedEvents_; }
+    void SetGroupPairsAllowedByDefault(bool allowed);
+    bool GetGroupPairsAllowedByDefault() const { return groupPairsAllowedByDefault_; }
+    void SetMaxPooledBodies(unsigned count) { maxPooledBodies_ = count; }
+    unsigned GetMaxPooledBodies() const { return maxPooledBodies_; }
+    void SetReplicationMode(HitReplicationMode mode);
+    HitReplicationMode GetReplicationMode() const { return replicationMode_; }
+    /// Budget of queued event dispatch per frame, zero means unlimited. Immediate events are not limited.
+    /// Dispatch budget is enabled if either of limits is set.
+    /// @{
+    void SetMaxDispatchedEvents(unsigned count) { maxDispatchedEvents_ = count; }
+    unsigned GetMaxDispatchedEvents() const { return maxDispatchedEvents_; }
+    /// Time budget in milliseconds. At least one queued event is dispatched per frame.
+    void SetDispatchTimeBudget(float milliseconds) { dispatchTimeBudget_ = milliseconds; }
+    float GetDispatchTimeBudget() const { return dispatchTimeBudget_; }
     /// @}
+    /// @}
+
+    /// Return whether dispatch budget is enabled.
+    bool IsDispatchBudgetEnabled() const { return maxDispatchedEvents_ != 0 || dispatchTimeBudget_ > 0.0f; }
+    /// Return number of events waiting in dispatch queue.
+    unsigned GetNumQueuedEvents() const { return dispatchQueue_.size(); }
+
+    /// Create detached rigid bodies in advance, so spawning hit components does not allocate them.
+    void ReserveRigidBodies(unsigned count);
+
+    /// Return index of the last update.
+    unsigned GetFrameIndex() const { return frameIndex_; }
+    /// Return sum of time steps of all updates. Used as time base for expiration of fading hits.
+    double GetElapsedTime() const { return elapsedTime_; }
+
+    /// Write state of all hits into flat binary buffer, reusing its capacity.
+    /// Includes overlaps found by shape broadphase and previous positions of continuous triggers.
+    /// Should be called between updates. Objects are referenced by handles, so snapshot is valid only for this scene.
+    void SaveSnapshot(ea::vector<unsigned char>& buffer);
+    /// Restore state of all hits from snapshot. Owners and components destroyed since snapshot are ignored.
+    /// Hit indices are rebuilt without sending events. Returns false and clears all hits if snapshot is invalid.
+    /// Events queued by dispatch budget are dispatched before restore.
+    bool RestoreSnapshot(ea::span<const unsigned char> buffer);
+    /// Set whether to suppress listeners and events, e.g. during re-simulation after RestoreSnapshot.
+    /// Hit state and indices are still updated.
+    void SetSuppressEvents(bool suppress) { suppressEvents_ = suppress; }
+    bool GetSuppressEvents() const { return suppressEvents_; }
+
+    /// Replication of hits, see HitReplicationMode. Owners are identified by node IDs.
+    /// Data should be delivered to client reliably and in order.
+    /// @{
+    /// Write hits started and stopped since the previous call into bit-packed buffer. Server only.
+    /// Size of the data depends on number of changed hits, not on number of ongoing hits.
+    /// If more than MaxReplicatedEvents are buffered, they are dropped and clients need new baseline.
+    void WriteReplicationDelta(ea::vector<unsigned char>& buffer);
+    /// Write all current hits without consuming delta. Used to initialize new client. Server only.
+    void WriteReplicationBaseline(ea::vector<unsigned char>& buffer);
+    /// Apply baseline or delta received from server and send events for changed hits. Client only.
+    /// Hits of owners missing on client are ignored. Fading hits stay ongoing until stopped by server.
+    bool ApplyReplicationData(ea::span<const unsigned char> buffer);
+    /// @}
+
+    /// Start recording raw hits, component states and time steps into binary trace file, see HitTraceReplayer.
+    /// Raw hits that are already ongoing are written at the beginning of the trace.
+    /// Group pair rules and changes of owner attributes after the first hit are not recorded.
+    bool StartTraceRecording(const ea::string& fileName);
+    /// Stop recording and write the rest of the trace.
+    void StopTraceRecording();
+    /// Return active trace recorder, if any.
+    HitTraceRecorder* GetTraceRecorder() const { return traceRecorder_.get(); }
+    /// Set replayer notified at each owner update step, so it applies recorded changes at the same point.
+    void SetTraceReplayer(HitTraceReplayer* replayer) { traceReplayer_ = replayer; }
+
+    /// Return statistics of the last update.
+    const HitStatistics& GetStatistics() const { return statistics_; }
+    /// Set whether to measure time spent in each stage of the update. Disabled by default.
+    void SetCollectTimings(bool enabled) { collectTimings_ = enabled; }
+    bool GetCollectTimings() const { return collectTimings_; }
+
+    /// Return hits started and stopped during current frame, in dispatch order.
+    /// Populated only if batched events are enabled. Valid while E_HITBATCH is handled.
+    ea::span<const HitEvent> GetBatchedEvents() const { return batchedEvents_; }
 
 protected:
     /// Implement TrackedComponentRegistryBase.
     /// @{
     void OnAddedToScene(Scene* scene) override;
     void OnRemovedFromScene() override;
+    void OnComponentAdded(TrackedComponentBase* baseComponent) override;
+    void OnComponentRemoved(TrackedComponentBase* baseComponent) override;
     /// @}
 
 private:
-    void Update(VariantMap& eventData);
+    /// Hit components attached to rigid body. Entry is valid only while body is alive.
+    struct HitBody
+    {
+        WeakPtr<RigidBody> body_;
+        ea::vector<HitDetector*> detectors_;
+        HitTrigger* trigger_{};
+    };
+
+    void SubscribeToUpdateEvents(Scene* scene);
+    void OnSceneSubsystemUpdate(VariantMap& eventData);
+    void OnPhysicsPostStep(VariantMap& eventData);
+    void OnScenePostUpdate(VariantMap& eventData);
+    /// Return whether updates in PhysicsStep mode follow physics steps rather than scene updates.
+    bool IsUpdatedByPhysicsSteps() const;
+    void OnPhysicsCollision(VariantMap& eventData, bool isStarted);
+    /// Return hit components of the body. Stale entry of destroyed body is removed.
+    const HitBody* FindHitBody(const RigidBody* rigidBody);
+    void UpdateComponentStates(ea::span<HitOwner* const> owners);
+    void UpdateOwnersInParallel();
+    void ExpireFadingHits();
+    /// Mark the point before owner update or expiration where event handlers of previous owners are done.
+    void BeginOwnerStep();
+    /// Dispatch queued events within frame budget, or all of them if budget is ignored.
+    void DispatchQueuedEvents(bool ignoreBudget);
+    void ClearDispatchQueue();
+    void PoolReleasedBodies();
+    void SweepContinuousTriggers();
+    void SendBatchedEvents();
+    void CompileGroupPairMatrix();
+    void ClearAllHits();
+    /// Remove indexed hits. Buckets are emptied in place and removed by RebuildIndexedHits if they stay empty,
+    /// so restoring similar state does not reallocate them.
+    void ClearIndexedHits();
+    void RebuildIndexedHits();
+    void AddIndexedHit(const HitReference& reference, const GroupHitInfo& hit);
+    void RemoveIndexedHit(const HitReference& reference);
+    void RemoveIndexedHitsOfOwner(HitOwner* owner);
+    void RemoveIdleOwners();
+    void ClearScheduledOwners();
+
+    struct ReplicatedHitEvent
+    {
+        bool isStarted_{};
+        unsigned detectorNode_{};
+        unsigned triggerNode_{};
+        HitGroupId detectorGroup_{};
+        HitGroupId triggerGroup_{};
+        HitId id_{};
+    };
+    static ReplicatedHitEvent MakeReplicatedEvent(bool isStarted, const GroupHitInfo& hit);
+    void WriteReplicationData(HitBitWriter& writer, unsigned firstGroup, ea::span<const ReplicatedHitEvent> events) const;
+
+    unsigned frameIndex_{};
+    double elapsedTime_{};
+    /// Number of updates. Unlike frame index, it is never rewound, so per-update caches stay valid after restore.
+    unsigned evaluationIndex_{};
+    /// Physics world of the scene, cached when added to scene or when the world makes its first step.
+    WeakPtr<PhysicsWorld> physicsWorld_;
+    /// Physics steps since the last update in PhysicsStep mode.
+    /// @{
+    unsigned numPendingPhysicsSteps_{};
+    float pendingPhysicsTime_{};
+    /// @}
+
+    /// HitHandle consists of slot index plus one in lower bits and slot generation in upper bits.
+    static constexpr unsigned HitHandleSlotBits = 20;
+    static constexpr unsigned HitHandleSlotMask = (1u << HitHandleSlotBits) - 1;
+    static constexpr unsigned HitHandleGenerationMask = (1u << (32 - HitHandleSlotBits)) - 1;
+
+    struct HitObjectSlot
+    {
+        Component* object_{};
+        unsigned generation_{};
+    };
+    ea::vector<HitObjectSlot> hitObjects_;
+    ea::vector<unsigned> freeHitObjects_;
+
+    /// Owners that have raw or group hits. Removed owners are replaced with null until the end of the update.
+    ea::vector<HitOwner*> scheduledOwners_;
+    ea::vector<HitEvent> batchedEvents_;
+
+    struct HitExpiration
+    {
+        double expirationTime_{};
+        WeakPtr<HitOwner> owner_;
+        HitId id_{};
+
+        /// Used to build min-heap.
+        bool operator<(const HitExpiration& rhs) const { return expirationTime_ > rhs.expirationTime_; }
+    };
+    /// Min-heap of fading hit expirations. Entries of restarted hits are discarded when they reach the top.
+    ea::vector<HitExpiration> hitExpirations_;
+
+    struct IndexedHit
+    {
+        HitReference reference_;
+        const HitOwner* trigger_{};
+        HitGroupId detectorGroup_{};
+        HitGroupId triggerGroup_{};
+        /// Positions of the hit in buckets of hitsByTrigger_, hitsByGroup_ and hitsByPair_.
+        /// Trigger group position is not used if both groups are the same.
+        /// @{
+        unsigned triggerIndex_{};
+        unsigned detectorGroupIndex_{};
+        unsigned triggerGroupIndex_{};
+        unsigned pairIndex_{};
+        /// @}
+    };
+
+    struct OwnerPairKey
+    {
+        const HitOwner* detector_{};
+        const HitOwner* trigger_{};
+
+        bool operator==(const OwnerPairKey& rhs) const { return detector_ == rhs.detector_ && trigger_ == rhs.trigger_; }
+
+        unsigned ToHash() const
+        {
+            unsigned hash = static_cast<unsigned>(ea::hash<const void*>{}(detector_));
+            CombineHash(hash, static_cast<unsigned>(ea::hash<const void*>{}(trigger_)));
+            return hash;
+        }
+    };
+
+    /// Indices of dispatched hits. Trigger pointers are used only as keys and may be dangling.
+    /// Indexed hits are stored in arbitrary order.
+    /// @{
+    HitKeyIndex<HitReference> indexedHitIndex_;
+    ea::vector<IndexedHit> indexedHits_;
+    ea::unordered_map<const HitOwner*, ea::vector<HitReference>> hitsByTrigger_;
+    ea::unordered_map<HitGroupId, ea::vector<HitReference>> hitsByGroup_;
+    ea::unordered_map<OwnerPairKey, ea::vector<HitReference>> hitsByPair_;
+    /// @}
+    HitListenerList listeners_;
+    HitBroadphase broadphase_;
+
+    /// Detached rigid bodies of destroyed nodes.
+    ea::vector<SharedPtr<RigidBody>> bodyPool_;
+    /// Bodies released by hit components and not yet removed from their nodes.
+    ea::vector<SharedPtr<RigidBody>> releasedBodies_;
+    ea::vector<CollisionShape*> tempCollisionShapes_;
+
+    ea::unordered_map<const RigidBody*, HitBody> hitBodies_;
+    /// Collision layers of all bodies ever registered, used to reject unrelated collisions without lookup.
+    unsigned detectorBodyLayers_{};
+    unsigned triggerBodyLayers_{};
+
+    struct ContinuousTrigger
+    {
+        WeakPtr<HitTrigger> trigger_;
+        ea::optional<Vector3> previousCenter_;
+    };
+    ea::vector<ContinuousTrigger> continuousTriggers_;
+    ea::vector<HitDetector*> sweptDetectors_;
+
+    HitStatistics statistics_;
+    /// Statistics collected by each WorkQueue thread during parallel update.
+    ea::vector<HitStatistics> threadStatistics_;
+    bool collectTimings_{};
+    bool suppressEvents_{};
+
+    /// Server: events since the last delta and number of groups already sent.
+    /// @{
+    ea::vector<ReplicatedHitEvent> replicatedEvents_;
+    ea::vector<ReplicatedHitEvent> baselineEvents_;
+    unsigned numReplicatedGroups_{};
+    /// @}
+    ea::unique_ptr<HitTraceRecorder> traceRecorder_;
+    HitTraceReplayer* traceReplayer_{};
+
+    struct QueuedHitEvent
+    {
+        HitDispatchPriority priority_{};
+        /// Events of the same priority are dispatched in order of queueing.
+        unsigned long long sequence_{};
+        /// Hit key captured when queued, detector owner may be destroyed before dispatch.
+        HitReference reference_;
+        HitEvent event_;
+
+        /// Top of max-heap is the event of the highest priority that was queued first.
+        bool operator<(const QueuedHitEvent& rhs) const
+        {
+            if (priority_ != rhs.priority_)
+                return priority_ < rhs.priority_;
+            return sequence_ > rhs.sequence_;
+        }
+    };
+    /// Number of queued events and lowest priority among them, per hit.
+    /// Later events of the same hit never get higher priority, so start is always delivered before stop.
+    struct QueuedHit
+    {
+        unsigned numEvents_{};
+        HitDispatchPriority priority_{};
+    };
+    ea::vector<QueuedHitEvent> dispatchQueue_;
+    ea::unordered_map<HitReference, QueuedHit> queuedHits_;
+    unsigned long long nextDispatchSequence_{};
+    ea::vector<HitDispatchPriority> groupDispatchPriorities_;
+
+    /// Client: local group identifiers by server group identifiers.
+    ea::vector<HitGroupId> serverGroupIds_;
+    ea::string tempGroupName_;
+
+    ea::vector<ea::string> groupNames_{EMPTY_STRING};
+    ea::unordered_map<ea::string, HitGroupId> groupIds_{{EMPTY_STRING, HitGroupId::Default}};
+
+    /// Explicit rules keyed by detector group in upper bits and trigger group in lower bits.
+    ea::unordered_map<unsigned long long, bool> groupPairRules_;
+    bool groupPairsAllowedByDefault_{true};
+    /// Bit matrix of allowed pairs with row per detector group, compiled from rules.
+    ea::vector<unsigned> groupPairMatrix_{1u};
+    unsigned groupPairMatrixStride_{1};
 
     unsigned triggerCollisionMask_{DefaultTriggerCollisionMask};
     unsigned triggerCollisionLayer_{DefaultTriggerCollisionLayer};
     unsigned detectorCollisionMask_{DefaultDetectorCollisionMask};
     unsigned detectorCollisionLayer_{DefaultDetectorCollisionLayer};
+    HitDetectionMode detectionMode_{};
+    HitUpdateMode updateMode_{};
+    bool parallelUpdate_{};
+    bool sendHitEvents_{true};
+    bool sendBatchedEvents_{};
+    unsigned maxPooledBodies_{DefaultMaxPooledBodies};
+    HitReplicationMode replicationMode_{};
+    unsigned maxDispatchedEvents_{};
+    float dispatchTimeBudget_{};
 };
 
+template <class T> void HitManager::ForEachActiveHit(const HitFilter& filter, const T& callback)
+{
+    HitCursor cursor{this, filter};
+    while (const GroupHitInfo* hit = cursor.Next())
+        callback(*hit);
+}
+
+template <class T> void HitManager::ForEachHit(ea::span<const HitReference> hits, const T& callback) const
+{
+    for (const HitReference& reference : hits)
+    {
+        if (const GroupHitInfo* hit = GetHitInfo(reference))
+            callback(*hit);
+    }
+}
+
 } // namespace Urho3D
@@ -1,7 +1,9 @@
 #include "HitOwner.h"
 
+#include "HitTrace.h"
+
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/IO/Log.h>
-#include <Urho3D/Physics/PhysicsEvents.h>
 #include <Urho3D/Physics/RigidBody.h>
 #include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Scene/SceneEvents.h>
@@ -12,39 +14,73 @@ namespace Urho3D
 namespace
 {
 
-bool IsExpiredHit(const ComponentHitInfo& hit)
+bool IsExpiredHit(const HitManager* hitManager, const ComponentHitInfo& hit)
 {
-    return !hit.detector_ || !hit.trigger_;
+    return !hitManager->GetHitObject(hit.detector_) || !hitManager->GetHitObject(hit.trigger_);
 }
 
-bool IsSameHit(const ComponentHitInfo& hit, HitDetector* detector, HitTrigger* trigger)
+bool IsSameHit(const ComponentHitInfo& hit, HitHandle detector, HitHandle trigger)
 {
     return hit.detector_ == detector && hit.trigger_ == trigger;
 }
 
-bool IsSameHit(const GroupHitInfo& hit, HitOwner* triggerOwner,
-    const ea::string& detectorGroupId, const ea::string& triggerGroupId)
+GroupHitKey GetMergeKey(const HitRecord& hit)
 {
-    return hit.trigger_ == triggerOwner && hit.detectorGroup_ == detectorGroupId && hit.triggerGroup_ == triggerGroupId;
+    return GroupHitKey{hit.trigger_, hit.detectorGroup_, hit.triggerGroup_};
 }
 
-bool IsComponentHitActive(HitOwner* detectorOwner, HitDetector* detector, HitTrigger* trigger)
+/// Sets of hits up to this size are scanned linearly instead of indexing them.
+const unsigned MaxLinearSearchHits = 8;
+
+unsigned FindHitByMergeKey(const ea::vector<HitRecord>& hits, const GroupHitKey& key)
 {
-    return detectorOwner->IsEnabled() && trigger->IsEnabledForDetector(detector);
+    for (unsigned index = 0; index < hits.size(); ++index)
+    {
+        if (GetMergeKey(hits[index]) == key)
+            return index;
+    }
+    return M_MAX_UNSIGNED;
 }
 
-bool HasHitInCollection(ea::span<const GroupHitInfo> collection, HitOwner* triggerOwner,
-    const ea::string& detectorGroupId, const ea::string& triggerGroupId)
+void NotifyListeners(HitListenerList& listeners, const HitEvent& event)
 {
-    return ea::any_of(collection.begin(), collection.end(), [&](const GroupHitInfo& hit) //
-    { //
-        return IsSameHit(hit, triggerOwner, detectorGroupId, triggerGroupId);
-    });
+    if (listeners.IsEmpty())
+        return;
+
+    if (event.eventType_ == E_HITSTARTED)
+        listeners.NotifyHitStarted(event.hit_);
+    else
+        listeners.NotifyHitStopped(event.hit_);
 }
 
-bool IsGroupMergeKeyEqual(const GroupHitInfo& lhs, const GroupHitInfo& rhs)
+/// Accumulate time elapsed in the scope, if enabled.
+class ScopedStageTimer
 {
-    return lhs.MergeKey() == rhs.MergeKey();
+public:
+    ScopedStageTimer(bool enabled, long long& elapsed)
+        : elapsed_(enabled ? &elapsed : nullptr)
+    {
+        if (elapsed_)
+            timer_.emplace();
+    }
+
+    ~ScopedStageTimer()
+    {
+        if (elapsed_)
+            *elapsed_ += timer_->GetUSec(false);
+    }
+
+private:
+    long long* elapsed_{};
+    ea::optional<HiresTimer> timer_;
+};
+
+const char* hitShapeTypeNames[] = {
+    "None",
+    "Sphere",
+    "Capsule",
+    "Box",
+    nullptr
 };
 
 } // namespace
@@ -60,136 +96,672 @@ void HitOwner::RegisterObject(Context* context)
 
     URHO3D_ACCESSOR_ATTRIBUTE("Is Enabled", IsEnabled, SetEnabled, bool, true, AM_DEFAULT);
     URHO3D_ACCESSOR_ATTRIBUTE("Trigger Fade Out", GetTriggerFadeOut, SetTriggerFadeOut, float, 0.0f, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Team Mask", GetTeamMask, SetTeamMask, unsigned, M_MAX_UNSIGNED, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Target Team Mask", GetTargetTeamMask, SetTargetTeamMask, unsigned, M_MAX_UNSIGNED, AM_DEFAULT);
+}
+
+const ea::vector<GroupHitInfo>& HitOwner::GetHits() const
+{
+    UpdateHitViews();
+    return hitViews_;
+}
+
+ea::span<const GroupHitInfo> HitOwner::GetOngoingHits() const
+{
+    UpdateHitViews();
+    return {hitViews_.data(), numOngoingHitViews_};
+}
+
+ea::span<const GroupHitInfo> HitOwner::GetFadingHits() const
+{
+    UpdateHitViews();
+    return ea::span<const GroupHitInfo>{hitViews_}.subspan(numOngoingHitViews_);
 }
 
 const GroupHitInfo* HitOwner::GetHitInfo(HitId id) const
 {
-    const auto isSameId = [id](const GroupHitInfo& hit) { return hit.id_ == id; };
-    const auto iter = ea::find_if(groupHits_.begin(), groupHits_.end(), isSameId);
-    return iter != groupHits_.end() ? &*iter : nullptr;
+    const HitIdSlot* slot = GetIdSlot(id);
+    if (!slot)
+        return nullptr;
+
+    const ea::span<const GroupHitInfo> hits = slot->isFading_ ? GetFadingHits() : GetOngoingHits();
+    return slot->hitIndex_ < hits.size() ? &hits[slot->hitIndex_] : nullptr;
+}
+
+const HitRecord* HitOwner::GetHitRecord(HitId id) const
+{
+    const HitIdSlot* slot = GetIdSlot(id);
+    if (!slot)
+        return nullptr;
+
+    const ea::vector<HitRecord>& hits = slot->isFading_ ? fadingHits_ : groupHits_;
+    return slot->hitIndex_ < hits.size() ? &hits[slot->hitIndex_] : nullptr;
+}
+
+void HitOwner::UpdateHitViews() const
+{
+    HitManager* hitManager = GetRegistry();
+    if (!hitManager)
+    {
+        // Views are rebuilt once owner is registered again
+        hitViews_.clear();
+        numOngoingHitViews_ = 0;
+        hitViewsDirty_ = true;
+        return;
+    }
+
+    const double elapsedTime = hitManager->GetElapsedTime();
+    if (hitViewsDirty_)
+    {
+        hitViewsDirty_ = false;
+        hitViews_.clear();
+        for (const HitRecord& hit : groupHits_)
+            hitViews_.push_back(hitManager->MakeHitInfo(hit));
+        numOngoingHitViews_ = hitViews_.size();
+        for (const HitRecord& hit : fadingHits_)
+            hitViews_.push_back(hitManager->MakeHitInfo(hit));
+    }
+    else if (hitViewsElapsedTime_ != elapsedTime)
+    {
+        // Time to expire is counted from expiration time scheduled in HitManager
+        for (unsigned index = 0; index < fadingHits_.size(); ++index)
+        {
+            const double timeToExpire = fadingHits_[index].expirationTime_ - elapsedTime;
+            hitViews_[numOngoingHitViews_ + index].timeToExpire_ = static_cast<float>(timeToExpire);
+        }
+    }
+    hitViewsElapsedTime_ = elapsedTime;
 }
 
 void HitOwner::RemoveExpiredRawHits()
 {
-    ea::erase_if(componentHits_, [](const ComponentHitInfo& hit) { return IsExpiredHit(hit); });
+    URHO3D_PROFILE("Remove Expired Raw Hits");
+
+    if (!hasRemovedComponentHits_)
+        return;
+
+    const HitManager* hitManager = GetRegistry();
+    hasRemovedComponentHits_ = false;
+
+    // Keep order of raw hits and update index only for hits that are removed or moved
+    unsigned numHits = 0;
+    for (unsigned index = 0; index < componentHits_.size(); ++index)
+    {
+        const ComponentHitInfo& hit = componentHits_[index];
+        const bool isExpired = IsExpiredHit(hitManager, hit);
+        if (isExpired || numHits != index)
+        {
+            const ComponentHitKey key{hit.detector_, hit.trigger_};
+            if (componentHitIndex_.Find(key) == index)
+            {
+                if (isExpired)
+                    componentHitIndex_.Erase(key);
+                else
+                    componentHitIndex_.Set(key, numHits);
+            }
+        }
+
+        if (!isExpired)
+            componentHits_[numHits++] = hit;
+    }
+    componentHits_.resize(numHits);
 }
 
 void HitOwner::CalculateGroupHits()
 {
+    URHO3D_PROFILE("Calculate Group Hits");
+
+    const HitManager* hitManager = GetRegistry();
     ea::swap(groupHits_, previousGroupHits_);
     groupHits_.clear();
+    groupHitKeys_.Reset(componentHits_.size());
 
-    for (const ComponentHitInfo& componentHit : componentHits_)
+    for (unsigned index = 0; index < componentHits_.size(); ++index)
     {
-        const bool isActive = IsComponentHitActive(this, componentHit.detector_, componentHit.trigger_);
+        ComponentHitInfo& componentHit = componentHits_[index];
+
+        // Components may be destroyed at any time, compact on the next update
+        const auto detector = hitManager->GetHitObject<HitDetector>(componentHit.detector_);
+        const auto trigger = hitManager->GetHitObject<HitTrigger>(componentHit.trigger_);
+        if (!detector || !trigger)
+        {
+            hasRemovedComponentHits_ = true;
+            continue;
+        }
+
+        componentHit.evaluated_ = true;
+
+        // Transient hit is evaluated in this update and then removed as if collision ended
+        if (componentHit.transient_)
+        {
+            const ComponentHitKey key{componentHit.detector_, componentHit.trigger_};
+            if (componentHitIndex_.Find(key) == index)
+                componentHitIndex_.Erase(key);
+
+            componentHit = {};
+            hasRemovedComponentHits_ = true;
+        }
+
+        // Trigger state is evaluated once per frame in PrepareUpdate
+        const bool isActive = IsEnabled() && trigger->IsEnabledInFrame();
         if (!isActive)
             continue;
 
-        HitOwner* detectorOwner = componentHit.detector_->GetHitOwner();
+        HitOwner* detectorOwner = detector->GetHitOwner();
         URHO3D_ASSERT(detectorOwner == this);
 
-        HitOwner* triggerOwner = componentHit.trigger_->GetHitOwner();
+        HitOwner* triggerOwner = trigger->GetHitOwner();
         if (!triggerOwner)
         {
             URHO3D_ASSERTLOG(false, "HitOwner of the trigger is null");
             continue;
         }
 
-        const ea::string& detectorGroupId = componentHit.detector_->GetGroupId();
-        const ea::string& triggerGroupId = componentHit.trigger_->GetGroupId();
-        if (HasHitInCollection(groupHits_, triggerOwner, detectorGroupId, triggerGroupId))
+        if (triggerOwner == detectorOwner)
+            continue;
+
+        const HitHandle triggerOwnerHandle = triggerOwner->GetHitHandle();
+        const HitGroupId detectorGroupId = detector->GetInternedGroupId();
+        const HitGroupId triggerGroupId = trigger->GetInternedGroupId();
+
+        // Rules may change after contact has started
+        if (!hitManager->IsGroupPairAllowed(detectorGroupId, triggerGroupId)
+            || !hitManager->IsTeamPairAllowed(this, triggerOwner))
             continue;
 
-        const WeakPtr<HitOwner> weakDetector{detectorOwner};
-        const WeakPtr<HitOwner> weakTrigger{triggerOwner};
-        groupHits_.push_back(GroupHitInfo{weakDetector, weakTrigger, detectorGroupId, triggerGroupId});
+        const GroupHitKey key{triggerOwnerHandle, detectorGroupId, triggerGroupId};
+        if (!groupHitKeys_.Insert(key, groupHits_.size()).second)
+            continue;
+
+        groupHits_.push_back(HitRecord{hitHandle_, triggerOwnerHandle, detectorGroupId, triggerGroupId});
     }
 }
 
-void HitOwner::StartAndStopHits(float timeStep)
+void HitOwner::StartAndStopHits(HitStatistics& statistics)
 {
-    for (GroupHitInfo& groupHit : groupHits_)
+    URHO3D_PROFILE("Start And Stop Hits");
+
+    const HitManager* hitManager = GetRegistry();
+    const unsigned frameIndex = hitManager->GetFrameIndex();
+
+    // First hit with the same key wins, same as linear search would do
+    const bool useIndex = previousGroupHits_.size() > MaxLinearSearchHits;
+    if (useIndex)
     {
-        const auto iterPrevious =
-            ea::find(previousGroupHits_.begin(), previousGroupHits_.end(), groupHit, IsGroupMergeKeyEqual);
-        if (iterPrevious == previousGroupHits_.end())
+        previousGroupHitIndex_.Reset(previousGroupHits_.size());
+        for (unsigned index = 0; index < previousGroupHits_.size(); ++index)
+            previousGroupHitIndex_.Insert(GetMergeKey(previousGroupHits_[index]), index);
+    }
+
+    // Descriptions are rebuilt only if any hit is started, stopped, restarted or moved
+    bool isChanged = groupHits_.size() != previousGroupHits_.size();
+    for (unsigned index = 0; index < groupHits_.size(); ++index)
+    {
+        HitRecord& groupHit = groupHits_[index];
+        const GroupHitKey key = GetMergeKey(groupHit);
+        const unsigned previousIndex =
+            useIndex ? previousGroupHitIndex_.Find(key) : FindHitByMergeKey(previousGroupHits_, key);
+        if (previousIndex != M_MAX_UNSIGNED)
         {
-            groupHit.id_ = GetNextId();
-            OnHitStarted(groupHit);
+            HitRecord& previousHit = previousGroupHits_[previousIndex];
+            URHO3D_ASSERT(previousHit.id_ != HitId::Invalid);
+            groupHit.id_ = previousHit.id_;
+            groupHit.startFrameIndex_ = previousHit.startFrameIndex_;
+            previousHit.id_ = HitId::Invalid;
+            isChanged = isChanged || previousIndex != index;
             continue;
         }
 
-        URHO3D_ASSERT(iterPrevious->id_ != HitId::Invalid);
-        groupHit.id_ = iterPrevious->id_;
-        iterPrevious->id_ = HitId::Invalid;
+        isChanged = true;
+
+        // Fading hit continues without new events, its expiration timer is ignored when it fires
+        const unsigned fadingIndex = fadingHitIndex_.Find(key);
+        if (fadingIndex != M_MAX_UNSIGNED)
+        {
+            groupHit.id_ = fadingHits_[fadingIndex].id_;
+            groupHit.startFrameIndex_ = fadingHits_[fadingIndex].startFrameIndex_;
+            RemoveFadingHit(fadingIndex);
+            continue;
+        }
+
+        groupHit.id_ = AllocateId();
+        groupHit.startFrameIndex_ = frameIndex;
+        pendingEvents_.push_back(PendingHitEvent{E_HITSTARTED, groupHit});
+        ++statistics.numHitsStarted_;
     }
 
-    for (GroupHitInfo& groupHit : previousGroupHits_)
+    const double elapsedTime = hitManager->GetElapsedTime();
+    for (HitRecord& groupHit : previousGroupHits_)
     {
         if (groupHit.id_ == HitId::Invalid)
             continue;
 
-        if (!groupHit.timeToExpire_)
-        {
-            HitOwner* triggerOwner = groupHit.trigger_;
-            groupHit.timeToExpire_ = triggerOwner ? triggerOwner->GetTriggerFadeOut() : 0.0f;
-        }
-        else
+        isChanged = true;
+        const auto triggerOwner = hitManager->GetHitObject<HitOwner>(groupHit.trigger_);
+        const float fadeOut = triggerOwner ? triggerOwner->GetTriggerFadeOut() : 0.0f;
+        if (fadeOut <= 0.0f)
         {
-            *groupHit.timeToExpire_ -= timeStep;
+            ReleaseId(groupHit.id_);
+            pendingEvents_.push_back(PendingHitEvent{E_HITSTOPPED, groupHit});
+            ++statistics.numHitsStopped_;
+            continue;
         }
 
-        if (*groupHit.timeToExpire_ <= 0.0f)
-        {
-            OnHitStopped(groupHit);
+        // Keep expiring hit for a while, HitManager stops it when the time comes
+        groupHit.expirationTime_ = elapsedTime + fadeOut;
+        AddFadingHit(groupHit);
+        ++statistics.numHitsFading_;
+    }
+
+    UpdateIdSlots();
+    if (isChanged)
+        hitViewsDirty_ = true;
+}
+
+void HitOwner::ExpireFadingHit(HitId id, double expirationTime, HitStatistics& statistics)
+{
+    const HitIdSlot* slot = GetIdSlot(id);
+    if (!slot || !slot->isFading_)
+        return;
+
+    const unsigned index = slot->hitIndex_;
+    if (fadingHits_[index].expirationTime_ != expirationTime)
+        return;
+
+    const HitRecord hit = fadingHits_[index];
+    RemoveFadingHit(index);
+    ReleaseId(id);
+    pendingEvents_.push_back(PendingHitEvent{E_HITSTOPPED, hit});
+    ++statistics.numHitsStopped_;
+    hitViewsDirty_ = true;
+}
+
+void HitOwner::AddFadingHit(const HitRecord& hit)
+{
+    const unsigned index = fadingHits_.size();
+    fadingHits_.push_back(hit);
+    fadingHitIndex_.Insert(GetMergeKey(hit), index);
+    newFadingHits_.push_back(hit.id_);
+
+    HitIdSlot& slot = idSlots_[(static_cast<unsigned>(hit.id_) & HitIdSlotMask) - 1];
+    slot.hitIndex_ = index;
+    slot.isFading_ = true;
+}
+
+void HitOwner::RemoveFadingHit(unsigned index)
+{
+    fadingHitIndex_.Erase(GetMergeKey(fadingHits_[index]));
+
+    if (index + 1 != fadingHits_.size())
+    {
+        HitRecord& movedHit = fadingHits_[index];
+        movedHit = fadingHits_.back();
+        fadingHitIndex_.Set(GetMergeKey(movedHit), index);
+        idSlots_[(static_cast<unsigned>(movedHit.id_) & HitIdSlotMask) - 1].hitIndex_ = index;
+    }
+    fadingHits_.pop_back();
+}
+
+void HitOwner::UpdateEvents(HitStatistics& statistics)
+{
+    UpdateHits(statistics);
+    SendPendingEvents(statistics);
+}
+
+void HitOwner::PrepareUpdate(unsigned evaluationIndex)
+{
+    const HitManager* hitManager = GetRegistry();
+    HitTraceRecorder* recorder = hitManager->GetTraceRecorder();
+    if (recorder)
+        recorder->RecordOwnerEnabled(this);
+
+    for (const ComponentHitInfo& componentHit : componentHits_)
+    {
+        const auto detector = hitManager->GetHitObject<HitDetector>(componentHit.detector_);
+        const auto trigger = hitManager->GetHitObject<HitTrigger>(componentHit.trigger_);
+        if (!detector || !trigger)
             continue;
-        }
 
-        // Keep expiring hit for a while
-        groupHits_.push_back(groupHit);
+        detector->GetHitOwner();
+        detector->GetInternedGroupId();
+        trigger->UpdateFrameState(evaluationIndex);
+        if (recorder)
+            recorder->RecordTriggerEnabled(trigger);
     }
 }
 
-void HitOwner::UpdateEvents(float timeStep)
+void HitOwner::UpdateHits(HitStatistics& statistics)
 {
-    RemoveExpiredRawHits();
-    CalculateGroupHits();
-    StartAndStopHits(timeStep);
+    const bool collectTimings = GetRegistry()->GetCollectTimings();
+
+    {
+        ScopedStageTimer timer{collectTimings, statistics.removeExpiredRawHitsTime_};
+        RemoveExpiredRawHits();
+    }
+    {
+        ScopedStageTimer timer{collectTimings, statistics.calculateGroupHitsTime_};
+        CalculateGroupHits();
+    }
+    {
+        ScopedStageTimer timer{collectTimings, statistics.startAndStopHitsTime_};
+        StartAndStopHits(statistics);
+    }
+
+    ++statistics.numOwnersProcessed_;
+    statistics.numComponentHits_ += componentHits_.size();
+    statistics.numGroupHits_ += groupHits_.size();
 }
 
-void HitOwner::AddOngoingHit(HitDetector* detector, HitTrigger* trigger)
+void HitOwner::SendPendingEvents(HitStatistics& statistics)
 {
-    for (const ComponentHitInfo& hit : componentHits_)
+    HitManager* hitManager = GetRegistry();
+    for (HitId id : newFadingHits_)
     {
-        if (IsSameHit(hit, detector, trigger))
-            return;
+        if (const HitRecord* hit = GetHitRecord(id))
+            hitManager->ScheduleHitExpiration(this, id, hit->expirationTime_);
     }
+    newFadingHits_.clear();
 
-    const WeakPtr<HitDetector> weakDetector{detector};
-    const WeakPtr<HitTrigger> weakTrigger{trigger};
-    componentHits_.push_back(ComponentHitInfo{weakDetector, weakTrigger});
+    if (pendingEvents_.empty())
+        return;
+
+    URHO3D_PROFILE("Send Hit Events");
+
+    ScopedStageTimer timer{hitManager->GetCollectTimings(), statistics.sendEventsTime_};
+    const bool suppressEvents = hitManager->GetSuppressEvents();
+
+    // Event handlers may cause hit updates, so iterate by index
+    for (unsigned index = 0; index < pendingEvents_.size(); ++index)
+    {
+        const HitEvent event{pendingEvents_[index].eventType_, hitManager->MakeHitInfo(pendingEvents_[index].hit_)};
+        hitManager->IndexHitEvent(this, event);
+        hitManager->ReplicateHitEvent(event);
+        if (suppressEvents || hitManager->QueueHitEvent(event))
+            continue;
+
+        DispatchEvent(event, statistics);
+    }
+    pendingEvents_.clear();
+}
+
+void HitOwner::DispatchEvent(const HitEvent& event, HitStatistics& statistics)
+{
+    HitManager* hitManager = GetRegistry();
+    NotifyListeners(listeners_, event);
+    NotifyListeners(hitManager->GetListeners(), event);
+    if (hitManager->GetSendBatchedEvents())
+        hitManager->AddBatchedEvent(event);
+    if (hitManager->GetSendHitEvents())
+        SendEvent(event.eventType_, event.hit_);
+    ++statistics.numEventsDispatched_;
+}
+
+void HitOwner::AddOngoingHit(HitDetector* detector, HitTrigger* trigger)
+{
+    AddComponentHit(detector, trigger, false);
+}
+
+void HitOwner::AddTransientHit(HitDetector* detector, HitTrigger* trigger)
+{
+    AddComponentHit(detector, trigger, true);
 }
 
 void HitOwner::RemoveOngoingHit(HitDetector* detector, HitTrigger* trigger)
 {
-    for (ComponentHitInfo& hit : componentHits_)
+    HitManager* hitManager = GetRegistry();
+    if (!hitManager)
+        return;
+
+    hitManager->ScheduleUpdate(this);
+    if (HitTraceRecorder* recorder = hitManager->GetTraceRecorder())
+        recorder->RecordHit(HitTraceRecordType::RemoveOngoingHit, detector, trigger);
+
+    const HitHandle detectorHandle = detector->GetHitHandle();
+    const HitHandle triggerHandle = trigger->GetHitHandle();
+    const ComponentHitKey key{detectorHandle, triggerHandle};
+    const unsigned index = componentHitIndex_.Find(key);
+    if (index == M_MAX_UNSIGNED)
+        return;
+
+    ComponentHitInfo& hit = componentHits_[index];
+    if (IsSameHit(hit, detectorHandle, triggerHandle))
     {
-        if (IsSameHit(hit, detector, trigger))
+        // Contact that started and stopped between physics-driven updates is evaluated once as transient hit
+        if (!hit.evaluated_ && hitManager->GetUpdateMode() == HitUpdateMode::PhysicsStep)
         {
-            hit = {};
+            hit.transient_ = true;
             return;
         }
+
+        hit = {};
+        hasRemovedComponentHits_ = true;
+    }
+    componentHitIndex_.Erase(key);
+}
+
+void HitOwner::AddComponentHit(HitDetector* detector, HitTrigger* trigger, bool transient)
+{
+    HitManager* hitManager = GetRegistry();
+    if (!hitManager)
+        return;
+
+    hitManager->ScheduleUpdate(this);
+    if (HitTraceRecorder* recorder = hitManager->GetTraceRecorder())
+    {
+        const auto type = transient ? HitTraceRecordType::AddTransientHit : HitTraceRecordType::AddOngoingHit;
+        recorder->RecordHit(type, detector, trigger);
+    }
+
+    const HitHandle detectorHandle = detector->GetHitHandle();
+    const HitHandle triggerHandle = trigger->GetHitHandle();
+    const unsigned newIndex = componentHits_.size();
+    const ComponentHitKey key{detectorHandle, triggerHandle};
+    const auto [index, isInserted] = componentHitIndex_.Insert(key, newIndex);
+    if (!isInserted)
+    {
+        ComponentHitInfo& hit = componentHits_[index];
+        if (IsSameHit(hit, detectorHandle, triggerHandle))
+        {
+            // Hit found by continuous test is confirmed by collision
+            if (!transient)
+                hit.transient_ = false;
+            return;
+        }
+
+        // Indexed entry is removed
+        componentHitIndex_.Set(key, newIndex);
+    }
+
+    componentHits_.push_back(ComponentHitInfo{detectorHandle, triggerHandle, transient});
+}
+
+void HitOwner::AddReplicatedHit(const HitRecord& hit)
+{
+    const HitIdSlot* existingSlot = GetIdSlot(hit.id_);
+    if (hit.id_ == HitId::Invalid || (existingSlot && existingSlot->hitIndex_ != M_MAX_UNSIGNED))
+        return;
+
+    // Server identifiers are used as is, so stops are matched the same way as local hits.
+    // Slot index comes from network, so it is dropped if it is out of range or far beyond allocated slots
+    const unsigned value = static_cast<unsigned>(hit.id_);
+    const unsigned slotIndex = (value & HitIdSlotMask) - 1;
+    if (slotIndex >= HitIdSlotMask || slotIndex >= idSlots_.size() + MaxReplicatedIdSlotGap)
+        return;
+
+    if (slotIndex >= idSlots_.size())
+        idSlots_.resize(slotIndex + 1);
+
+    HitIdSlot& slot = idSlots_[slotIndex];
+    if (slot.hitIndex_ != M_MAX_UNSIGNED)
+        RemoveReplicatedHit(groupHits_[slot.hitIndex_].id_);
+
+    slot.generation_ = value >> HitIdSlotBits;
+    slot.hitIndex_ = groupHits_.size();
+    slot.isFading_ = false;
+    groupHits_.push_back(hit);
+
+    pendingEvents_.push_back(PendingHitEvent{E_HITSTARTED, hit});
+    hitViewsDirty_ = true;
+}
+
+void HitOwner::RemoveReplicatedHit(HitId id)
+{
+    const HitIdSlot* slot = GetIdSlot(id);
+    if (!slot || slot->hitIndex_ == M_MAX_UNSIGNED)
+        return;
+
+    const unsigned index = slot->hitIndex_;
+    const HitRecord hit = groupHits_[index];
+    if (index + 1 != groupHits_.size())
+    {
+        groupHits_[index] = groupHits_.back();
+        const unsigned movedSlotIndex = (static_cast<unsigned>(groupHits_[index].id_) & HitIdSlotMask) - 1;
+        idSlots_[movedSlotIndex].hitIndex_ = index;
+    }
+    groupHits_.pop_back();
+
+    const unsigned slotIndex = (static_cast<unsigned>(id) & HitIdSlotMask) - 1;
+    idSlots_[slotIndex].hitIndex_ = M_MAX_UNSIGNED;
+
+    pendingEvents_.push_back(PendingHitEvent{E_HITSTOPPED, hit});
+    hitViewsDirty_ = true;
+}
+
+void HitOwner::SaveSnapshot(HitSnapshotWriter& writer) const
+{
+    URHO3D_ASSERT(pendingEvents_.empty() && newFadingHits_.empty());
+
+    writer.WriteArray(componentHits_);
+    writer.WriteArray(groupHits_);
+    writer.WriteArray(fadingHits_);
+    writer.WriteArray(idSlots_);
+    writer.WriteArray(freeIdSlots_);
+}
+
+bool HitOwner::RestoreSnapshot(HitSnapshotReader& reader)
+{
+    ClearHitState();
+
+    if (!reader.ReadArray(componentHits_) || !reader.ReadArray(groupHits_) || !reader.ReadArray(fadingHits_)
+        || !reader.ReadArray(idSlots_) || !reader.ReadArray(freeIdSlots_))
+    {
+        ClearHitState();
+        return false;
+    }
+
+    // Removed raw hits may be stored in snapshot as is, compact them on the next update.
+    // Indices keep their storage, so restoring similar state does not allocate
+    hasRemovedComponentHits_ = true;
+    componentHitIndex_.Reset(componentHits_.size());
+    for (unsigned index = 0; index < componentHits_.size(); ++index)
+    {
+        const ComponentHitInfo& hit = componentHits_[index];
+        if (hit.detector_ != HitHandle::Invalid)
+            componentHitIndex_.Insert(ComponentHitKey{hit.detector_, hit.trigger_}, index);
     }
+
+    fadingHitIndex_.Reset(fadingHits_.size());
+    for (unsigned index = 0; index < fadingHits_.size(); ++index)
+        fadingHitIndex_.Insert(GetMergeKey(fadingHits_[index]), index);
+
+    return true;
 }
 
-HitId HitOwner::GetNextId()
+void HitOwner::ClearHitState()
 {
-    while (nextId_ == HitId::Invalid || GetHitInfo(nextId_) != nullptr)
-        AdvanceNextId();
+    // Identifier slots are kept, so identifiers of cleared hits are not reused by new ones
+    for (const HitRecord& hit : groupHits_)
+    {
+        if (GetIdSlot(hit.id_))
+            ReleaseId(hit.id_);
+    }
+    for (const HitRecord& hit : fadingHits_)
+    {
+        if (GetIdSlot(hit.id_))
+            ReleaseId(hit.id_);
+    }
 
-    const HitId id = nextId_;
-    AdvanceNextId();
-    return id;
+    componentHits_.clear();
+    componentHitIndex_.Reset(0);
+    hasRemovedComponentHits_ = false;
+    groupHits_.clear();
+    previousGroupHits_.clear();
+    fadingHits_.clear();
+    fadingHitIndex_.Reset(0);
+    newFadingHits_.clear();
+    pendingEvents_.clear();
+    hitViewsDirty_ = true;
+}
+
+void HitOwner::RecordTrace(HitTraceRecorder& recorder)
+{
+    const HitManager* hitManager = GetRegistry();
+    for (const ComponentHitInfo& componentHit : componentHits_)
+    {
+        const auto detector = hitManager->GetHitObject<HitDetector>(componentHit.detector_);
+        const auto trigger = hitManager->GetHitObject<HitTrigger>(componentHit.trigger_);
+        if (!detector || !trigger)
+            continue;
+
+        const auto type =
+            componentHit.transient_ ? HitTraceRecordType::AddTransientHit : HitTraceRecordType::AddOngoingHit;
+        recorder.RecordHit(type, detector, trigger);
+    }
+}
+
+HitId HitOwner::AllocateId()
+{
+    unsigned slotIndex = 0;
+    if (!freeIdSlots_.empty())
+    {
+        slotIndex = freeIdSlots_.back();
+        freeIdSlots_.pop_back();
+    }
+    else
+    {
+        slotIndex = idSlots_.size();
+        URHO3D_ASSERT(slotIndex < HitIdSlotMask);
+        idSlots_.emplace_back();
+    }
+
+    const unsigned generation = idSlots_[slotIndex].generation_;
+    return static_cast<HitId>((generation << HitIdSlotBits) | (slotIndex + 1));
+}
+
+void HitOwner::ReleaseId(HitId id)
+{
+    const unsigned slotIndex = (static_cast<unsigned>(id) & HitIdSlotMask) - 1;
+    HitIdSlot& slot = idSlots_[slotIndex];
+    slot.hitIndex_ = M_MAX_UNSIGNED;
+    slot.isFading_ = false;
+
+    // Slot is retired when its generation is exhausted, so identifiers never repeat.
+    // Generation of retired slot is out of range and matches no identifier.
+    ++slot.generation_;
+    if (slot.generation_ <= HitIdGenerationMask)
+        freeIdSlots_.push_back(slotIndex);
+}
+
+const HitOwner::HitIdSlot* HitOwner::GetIdSlot(HitId id) const
+{
+    const unsigned value = static_cast<unsigned>(id);
+    const unsigned slotIndex = (value & HitIdSlotMask) - 1;
+    const unsigned generation = value >> HitIdSlotBits;
+    if (id == HitId::Invalid || slotIndex >= idSlots_.size())
+        return nullptr;
+
+    const HitIdSlot& slot = idSlots_[slotIndex];
+    return slot.generation_ == generation ? &slot : nullptr;
+}
+
+void HitOwner::UpdateIdSlots()
+{
+    for (unsigned index = 0; index < groupHits_.size(); ++index)
+    {
+        const unsigned slotIndex = (static_cast<unsigned>(groupHits_[index].id_) & HitIdSlotMask) - 1;
+        idSlots_[slotIndex].hitIndex_ = index;
+        idSlots_[slotIndex].isFading_ = false;
+    }
 }
 
 void HitOwner::SendEvent(StringHash eventType, const GroupHitInfo& hit)
@@ -206,16 +778,6 @@ void HitOwner::SendEvent(StringHash eventType, const GroupHitInfo& hit)
     GetScene()->SendEvent(eventType, eventData);
 }
 
-void HitOwner::OnHitStarted(const GroupHitInfo& hit)
-{
-    SendEvent(E_HITSTARTED, hit);
-}
-
-void HitOwner::OnHitStopped(const GroupHitInfo& hit)
-{
-    SendEvent(E_HITSTOPPED, hit);
-}
-
 HitComponent::HitComponent(Context* context)
     : LogicComponent(context)
 {
@@ -223,8 +785,21 @@ HitComponent::HitComponent(Context* context)
 
 HitComponent::~HitComponent()
 {
+    HitManager* hitManager = hitManager_;
+    if (hitManager)
+    {
+        hitManager->RemoveBodyComponent(registeredBody_, this);
+        hitManager->RemoveShapeComponent(this, false);
+        hitManager->RemoveHitObject(hitHandle_);
+    }
+
     if (rigidBody_)
-        rigidBody_->Remove();
+    {
+        if (hitManager && isPooledBody_)
+            hitManager->ReleaseRigidBody(rigidBody_);
+        else if (isOwnBody_)
+            rigidBody_->Remove();
+    }
 }
 
 void HitComponent::RegisterObject(Context* context)
@@ -233,6 +808,75 @@ void HitComponent::RegisterObject(Context* context)
 
     URHO3D_ACCESSOR_ATTRIBUTE("Is Enabled", IsEnabled, SetEnabled, bool, true, AM_DEFAULT);
     URHO3D_ACCESSOR_ATTRIBUTE("Group Id", GetGroupId, SetGroupId, ea::string, EMPTY_STRING, AM_DEFAULT);
+    URHO3D_ENUM_ATTRIBUTE("Shape Type", shapeType_, hitShapeTypeNames, HitShapeType::None, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Shape Size", Vector3, shapeSize_, Vector3::ONE, AM_DEFAULT);
+    URHO3D_ATTRIBUTE("Shape Offset", Vector3, shapeOffset_, Vector3::ZERO, AM_DEFAULT);
+}
+
+HitShape HitComponent::GetWorldShape() const
+{
+    return HitShape::Create(shapeType_, shapeSize_, shapeOffset_, node_->GetWorldPosition(), node_->GetWorldRotation(),
+        node_->GetWorldScale());
+}
+
+void HitComponent::SetGroupId(const ea::string& value)
+{
+    groupId_ = value;
+    internedGroupId_ = ea::nullopt;
+
+    if (HitManager* hitManager = GetHitManager())
+        internedGroupId_ = hitManager->GetOrAddGroup(groupId_);
+}
+
+HitGroupId HitComponent::GetInternedGroupId()
+{
+    if (!internedGroupId_)
+    {
+        HitManager* hitManager = GetHitManager();
+        if (!hitManager)
+            return HitGroupId::Default;
+
+        internedGroupId_ = hitManager->GetOrAddGroup(groupId_);
+    }
+    return *internedGroupId_;
+}
+
+HitHandle HitComponent::GetHitHandle()
+{
+    if (hitHandle_ == HitHandle::Invalid)
+    {
+        if (HitManager* hitManager = GetHitManager())
+            hitHandle_ = hitManager->AddHitObject(this);
+    }
+    return hitHandle_;
+}
+
+void HitComponent::OnSceneSet(Scene* scene)
+{
+    LogicComponent::OnSceneSet(scene);
+
+    if (HitManager* hitManager = hitManager_)
+    {
+        hitManager->RemoveBodyComponent(registeredBody_, this);
+        hitManager->RemoveShapeComponent(this, true);
+        hitManager->RemoveHitObject(hitHandle_);
+
+        // Scene is unset before the component is destroyed, so pooled body is returned while HitManager is known
+        if (rigidBody_ && isPooledBody_)
+        {
+            hitManager->ReleaseRigidBody(rigidBody_);
+            rigidBody_ = nullptr;
+            isPooledBody_ = false;
+        }
+    }
+
+    hitManager_ = nullptr;
+    registeredBody_ = nullptr;
+    hitHandle_ = HitHandle::Invalid;
+    internedGroupId_ = ea::nullopt;
+
+    if (HitManager* hitManager = GetHitManager())
+        internedGroupId_ = hitManager->GetOrAddGroup(groupId_);
 }
 
 bool HitComponent::IsSelfAndOwnerEnabled()
@@ -255,16 +899,57 @@ HitOwner* HitComponent::GetHitOwner()
     return hitOwner;
 }
 
+HitManager* HitComponent::GetHitManager()
+{
+    HitManager* hitManager = hitManager_;
+    if (hitManager)
+        return hitManager;
+
+    Scene* scene = GetScene();
+    if (!scene)
+        return nullptr;
+
+    hitManager = scene->GetComponent<HitManager>();
+    hitManager_ = hitManager;
+    return hitManager;
+}
+
 void HitComponent::DelayedStart()
 {
-    rigidBody_ = node_->GetComponent<RigidBody>();
+    HitManager* hitManager = GetHitManager();
+    if (hitManager)
+        internedGroupId_ = hitManager->GetOrAddGroup(groupId_);
 
+    // Replicated hits don't need local shapes or bodies
+    if (hitManager && hitManager->GetReplicationMode() == HitReplicationMode::Client)
+        return;
+
+    // Shapes are also registered in Physics mode so continuous triggers can be tested against them
+    if (hitManager && shapeType_ != HitShapeType::None)
+        hitManager->AddShapeComponent(this);
+
+    if (hitManager && hitManager->GetDetectionMode() == HitDetectionMode::Shapes)
+        return;
+
+    rigidBody_ = node_->GetComponent<RigidBody>();
     if (!rigidBody_)
     {
-        rigidBody_ = node_->CreateComponent<RigidBody>();
+        if (hitManager)
+        {
+            rigidBody_ = hitManager->AcquireRigidBody(this);
+            isPooledBody_ = true;
+        }
+        else
+        {
+            rigidBody_ = node_->CreateComponent<RigidBody>();
+            isOwnBody_ = true;
+        }
+    }
 
-        if (auto hitManager = node_->GetScene()->GetComponent<HitManager>())
-            SetupRigidBody(hitManager, rigidBody_);
+    if (hitManager)
+    {
+        hitManager->AddBodyComponent(rigidBody_, this);
+        registeredBody_ = rigidBody_;
     }
 }
 
@@ -274,6 +959,26 @@ void HitTrigger::RegisterObject(Context* context)
 
     URHO3D_COPY_BASE_ATTRIBUTES(HitComponent);
     URHO3D_ACCESSOR_ATTRIBUTE("Velocity Threshold", GetVelocityThreshold, SetVelocityThreshold, float, 0.0f, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Continuous", IsContinuous, SetContinuous, bool, false, AM_DEFAULT);
+}
+
+void HitTrigger::DelayedStart()
+{
+    HitComponent::DelayedStart();
+
+    SetContinuous(continuous_);
+}
+
+void HitTrigger::SetContinuous(bool value)
+{
+    continuous_ = value;
+
+    // Trigger without shape in broadphase has nothing to sweep, it is registered when started
+    if (continuous_ && GetBroadphaseIndex() != M_MAX_UNSIGNED)
+    {
+        if (HitManager* hitManager = GetHitManager())
+            hitManager->AddContinuousTrigger(this);
+    }
 }
 
 bool HitTrigger::IsEnabledForDetector(HitDetector* hitDetector)
@@ -281,6 +986,16 @@ bool HitTrigger::IsEnabledForDetector(HitDetector* hitDetector)
     return IsSelfAndOwnerEnabled() && (GetHitOwner() != hitDetector->GetHitOwner()) && IsVelocityThresholdSatisfied();
 }
 
+void HitTrigger::UpdateFrameState(unsigned evaluationIndex)
+{
+    if (evaluationIndex_ == evaluationIndex)
+        return;
+
+    evaluationIndex_ = evaluationIndex;
+    GetInternedGroupId();
+    isEnabledInFrame_ = IsSelfAndOwnerEnabled() && IsVelocityThresholdSatisfied();
+}
+
 void HitTrigger::SetupRigidBody(HitManager* hitManager, RigidBody* rigidBody)
 {
     const unsigned layer = hitManager->GetTriggerCollisionLayer();
@@ -292,16 +1007,22 @@ void HitTrigger::SetupRigidBody(HitManager* hitManager, RigidBody* rigidBody)
     rigidBody->SetMass(1.0f);
 }
 
-float HitTrigger::GetRigidBodyVelocity() const
+float HitTrigger::GetVelocitySquared()
 {
-    RigidBody* rigidBody = GetRigidBody();
-    return rigidBody ? rigidBody->GetLinearVelocity().Length() : 0.0f;
+    if (RigidBody* rigidBody = GetRigidBody())
+        return rigidBody->GetLinearVelocity().LengthSquared();
+
+    // Trigger without rigid body is detected by shape, so its velocity is tracked by broadphase
+    HitManager* hitManager = GetHitManager();
+    return hitManager ? hitManager->GetShapeVelocity(this).LengthSquared() : 0.0f;
 }
 
-bool HitTrigger::IsVelocityThresholdSatisfied() const
+bool HitTrigger::IsVelocityThresholdSatisfied()
 {
-    const float velocity = GetRigidBodyVelocity();
-    return velocityThreshold_ == 0.0f || velocity >= velocityThreshold_;
+    if (velocityThreshold_ <= 0.0f)
+        return true;
+
+    return GetVelocitySquared() >= velocityThreshold_ * velocityThreshold_;
 }
 
 void HitDetector::RegisterObject(Context* context)
@@ -311,39 +1032,13 @@ void HitDetector::RegisterObject(Context* context)
     URHO3D_COPY_BASE_ATTRIBUTES(HitComponent);
 }
 
-void HitDetector::DelayedStart()
-{
-    HitComponent::DelayedStart();
-
-    SubscribeToEvent(node_, E_NODECOLLISIONSTART,
-        [&](VariantMap& eventData)
-    {
-        auto otherNode = static_cast<Node*>(eventData[NodeCollisionStart::P_OTHERNODE].GetPtr());
-        auto hitTrigger = otherNode->GetComponent<HitTrigger>();
-        if (!hitTrigger)
-            return;
-
-        OnHitStarted(hitTrigger);
-    });
-
-    SubscribeToEvent(node_, E_NODECOLLISIONEND,
-        [&](VariantMap& eventData)
-    {
-        auto otherNode = static_cast<Node*>(eventData[NodeCollisionEnd::P_OTHERNODE].GetPtr());
-        auto hitTrigger = otherNode->GetComponent<HitTrigger>();
-        if (!hitTrigger)
-            return;
-
-        OnHitStopped(hitTrigger);
-    });
-}
-
 void HitDetector::SetupRigidBody(HitManager* hitManager, RigidBody* rigidBody)
 {
     const unsigned layer = hitManager->GetDetectorCollisionLayer();
     const unsigned mask = hitManager->GetDetectorCollisionMask();
 
     rigidBody->SetCollisionLayerAndMask(layer, mask);
+    rigidBody->SetTrigger(false);
     rigidBody->SetKinematic(true);
     rigidBody->SetMass(1.0f);
 }
@@ -352,7 +1047,7 @@ void HitDetector::OnHitStarted(HitTrigger* hitTrigger)
 {
     if (HitOwner* hitOwner = GetHitOwner())
     {
-        if (hitOwner != hitTrigger->GetHitOwner())
+        if (hitOwner != hitTrigger->GetHitOwner() && IsHitAllowed(hitTrigger))
             hitOwner->AddOngoingHit(this, hitTrigger);
     }
 }
@@ -366,4 +1061,24 @@ void HitDetector::OnHitStopped(HitTrigger* hitTrigger)
     }
 }
 
+void HitDetector::OnHitSwept(HitTrigger* hitTrigger)
+{
+    if (HitOwner* hitOwner = GetHitOwner())
+    {
+        if (hitOwner != hitTrigger->GetHitOwner() && IsHitAllowed(hitTrigger))
+            hitOwner->AddTransientHit(this, hitTrigger);
+    }
+}
+
+bool HitDetector::IsHitAllowed(HitTrigger* hitTrigger)
+{
+    HitManager* hitManager = GetHitManager();
+    HitOwner* triggerOwner = hitTrigger->GetHitOwner();
+    if (!hitManager || !triggerOwner)
+        return true;
+
+    return hitManager->IsGroupPairAllowed(GetInternedGroupId(), hitTrigger->GetInternedGroupId())
+        && hitManager->IsTeamPairAllowed(GetHitOwner(), triggerOwner);
+}
+
 } // namespace Urho3D
@@ -4,8 +4,6 @@
 
 #include <Urho3D/Scene/LogicComponent.h>
 
-#include <EASTL/tuple.h>
-
 namespace Urho3D
 {
 
@@ -14,37 +12,6 @@ class HitOwner;
 class HitTrigger;
 class RigidBody;
 
-/// Identifier of ongoing hit. Unique within the instance of HitOwner.
-enum class HitId : unsigned
-{
-    Invalid
-};
-
-/// Description of ongoing physical volume hit between HitTrigger and HitDetector.
-/// Components that belong to the same HitOwner never hit each other.
-/// There is no other filtering at this level.
-struct PLUGIN_CORE_HITMANAGER_API ComponentHitInfo
-{
-    WeakPtr<HitDetector> detector_;
-    WeakPtr<HitTrigger> trigger_;
-};
-
-/// Description of logical hit between two HitOwner objects.
-struct PLUGIN_CORE_HITMANAGER_API GroupHitInfo
-{
-    WeakPtr<HitOwner> detector_;
-    WeakPtr<HitOwner> trigger_;
-    ea::string detectorGroup_;
-    ea::string triggerGroup_;
-    HitId id_{};
-    /// Time before already stopped hit expires.
-    ea::optional<float> timeToExpire_;
-
-    /// Merge key is used to compare and merge sets of hits from different frames.
-    /// Hits that belong to the same HitOwner are supposed to have unique key triplets.
-    auto MergeKey() const { return ea::tie(trigger_, detectorGroup_, triggerGroup_); }
-};
-
 class PLUGIN_CORE_HITMANAGER_API HitOwner : public TrackedComponent<TrackedComponentBase, HitManager>
 {
     URHO3D_OBJECT(HitOwner, TrackedComponentBase);
@@ -53,43 +20,152 @@ public:
     HitOwner(Context* context);
     static void RegisterObject(Context* context);
 
-    /// Return all hits.
-    const ea::vector<GroupHitInfo>& GetHits() const { return groupHits_; }
+    /// Return ongoing hits followed by fading hits.
+    const ea::vector<GroupHitInfo>& GetHits() const;
+    /// Return hits that are not stopped.
+    ea::span<const GroupHitInfo> GetOngoingHits() const;
+    /// Return stopped hits that are waiting for trigger fade out to expire.
+    ea::span<const GroupHitInfo> GetFadingHits() const;
     /// Find hit by ID.
     const GroupHitInfo* GetHitInfo(HitId id) const;
 
+    /// Add or remove listener of hits detected by this owner.
+    /// @{
+    void AddListener(HitListener* listener) { listeners_.Add(listener); }
+    void RemoveListener(HitListener* listener) { listeners_.Remove(listener); }
+    /// @}
+
     /// Attributes.
     /// @{
     void SetTriggerFadeOut(float value) { triggerFadeOut_ = value; }
     float GetTriggerFadeOut() const { return triggerFadeOut_; }
+    /// Teams of the owner and teams that triggers of the owner can hit.
+    /// Hit is allowed if detector owner team mask intersects trigger owner target team mask.
+    /// @{
+    void SetTeamMask(unsigned value) { teamMask_ = value; }
+    unsigned GetTeamMask() const { return teamMask_; }
+    void SetTargetTeamMask(unsigned value) { targetTeamMask_ = value; }
+    unsigned GetTargetTeamMask() const { return targetTeamMask_; }
+    /// @}
     /// @}
 
     /// Internal.
     /// @{
-    void UpdateEvents(float timeStep);
+    HitHandle GetHitHandle() const { return hitHandle_; }
+    void SetHitHandle(HitHandle handle) { hitHandle_ = handle; }
+    bool IsIdle() const { return componentHits_.empty() && groupHits_.empty(); }
+    unsigned GetScheduledIndex() const { return scheduledIndex_; }
+    void SetScheduledIndex(unsigned index) { scheduledIndex_ = index; }
+
+    /// Update hits and send events immediately.
+    void UpdateEvents(HitStatistics& statistics);
+    /// Evaluate per-frame state of hit components. Should be called from main thread before UpdateHits.
+    void PrepareUpdate(unsigned evaluationIndex);
+    /// Update hits and store events in pending queue. Safe to call for different owners from worker threads.
+    void UpdateHits(HitStatistics& statistics);
+    /// Send pending events and schedule expiration of fading hits. Should be called from main thread.
+    /// Events of low priority groups may be queued in HitManager instead.
+    void SendPendingEvents(HitStatistics& statistics);
+    /// Deliver event to listeners, batch and event handlers.
+    void DispatchEvent(const HitEvent& event, HitStatistics& statistics);
+    /// Stop fading hit if it is still fading with the same expiration time. Event is sent by SendPendingEvents.
+    void ExpireFadingHit(HitId id, double expirationTime, HitStatistics& statistics);
     void AddOngoingHit(HitDetector* detector, HitTrigger* trigger);
     void RemoveOngoingHit(HitDetector* detector, HitTrigger* trigger);
+    /// Add hit that lasts for single update unless it is also reported as ongoing.
+    void AddTransientHit(HitDetector* detector, HitTrigger* trigger);
+
+    /// Start or stop hit received from server, see HitManager::ApplyReplicationData.
+    /// Events are buffered until SendPendingEvents. Repeated starts and unknown stops are ignored.
+    /// @{
+    void AddReplicatedHit(const HitRecord& hit);
+    void RemoveReplicatedHit(HitId id);
+    /// @}
+
+    /// Return whether owner has any raw, ongoing or fading hits. Identifier slots alone are not saved in snapshot.
+    bool HasHitState() const { return !componentHits_.empty() || !groupHits_.empty() || !fadingHits_.empty(); }
+    /// Write or read hit state, see HitManager::SaveSnapshot. Should be called between updates.
+    /// @{
+    void SaveSnapshot(HitSnapshotWriter& writer) const;
+    bool RestoreSnapshot(HitSnapshotReader& reader);
+    /// @}
+    /// Remove all hits without sending events. Identifiers of removed hits are released.
+    void ClearHitState();
+    /// Write current raw hits into trace.
+    void RecordTrace(HitTraceRecorder& recorder);
     /// @}
 
 private:
+    void AddComponentHit(HitDetector* detector, HitTrigger* trigger, bool transient);
     void RemoveExpiredRawHits();
     void CalculateGroupHits();
-    void StartAndStopHits(float timeStep);
-
-    void AdvanceNextId() { nextId_ = static_cast<HitId>(static_cast<unsigned>(nextId_) + 1); }
-    HitId GetNextId();
+    void StartAndStopHits(HitStatistics& statistics);
+    void AddFadingHit(const HitRecord& hit);
+    void RemoveFadingHit(unsigned index);
+
+    /// HitId consists of slot index plus one in lower bits and slot generation in upper bits.
+    static constexpr unsigned HitIdSlotBits = 20;
+    static constexpr unsigned HitIdSlotMask = (1u << HitIdSlotBits) - 1;
+    static constexpr unsigned HitIdGenerationMask = (1u << (32 - HitIdSlotBits)) - 1;
+    /// Replicated identifiers may skip slots, number of slots added at once is limited.
+    static constexpr unsigned MaxReplicatedIdSlotGap = 1024;
+
+    struct HitIdSlot
+    {
+        unsigned generation_{};
+        /// Index in groupHits_ or fadingHits_, valid while the slot is allocated.
+        unsigned hitIndex_{M_MAX_UNSIGNED};
+        bool isFading_{};
+        /// Explicit padding, so equal slots are stored as equal bytes in snapshots.
+        unsigned char padding_[3]{};
+    };
+
+    HitId AllocateId();
+    void ReleaseId(HitId id);
+    const HitIdSlot* GetIdSlot(HitId id) const;
+    void UpdateIdSlots();
 
     void SendEvent(StringHash eventType, const GroupHitInfo& hit);
-    void OnHitStarted(const GroupHitInfo& hit);
-    void OnHitStopped(const GroupHitInfo& hit);
+    const HitRecord* GetHitRecord(HitId id) const;
+    void UpdateHitViews() const;
 
+    /// Raw hits in order of addition. Removed and expired hits are compacted on the next update.
     ea::vector<ComponentHitInfo> componentHits_;
-    ea::vector<GroupHitInfo> groupHits_;
-    ea::vector<GroupHitInfo> previousGroupHits_;
+    /// Index of the latest entry in componentHits_ for each component pair.
+    HitKeyIndex<ComponentHitKey> componentHitIndex_;
+    bool hasRemovedComponentHits_{};
+    ea::vector<HitRecord> groupHits_;
+    ea::vector<HitRecord> previousGroupHits_;
+    /// Index of previousGroupHits_ by merge key, rebuilt every update.
+    HitKeyIndex<GroupHitKey> previousGroupHitIndex_;
+    /// Index of groupHits_ by merge key, rebuilt during CalculateGroupHits.
+    HitKeyIndex<GroupHitKey> groupHitKeys_;
+    /// Stopped hits in arbitrary order. They are not processed until restarted or expired.
+    ea::vector<HitRecord> fadingHits_;
+    HitKeyIndex<GroupHitKey> fadingHitIndex_;
+    /// Fading hits added in the last update, expiration is scheduled from main thread.
+    ea::vector<HitId> newFadingHits_;
+    ea::vector<PendingHitEvent> pendingEvents_;
+
+    /// Descriptions of groupHits_ followed by fadingHits_ in the same order, created from records on demand.
+    /// Time to expire of fading hits is refreshed when elapsed time changes.
+    /// @{
+    mutable ea::vector<GroupHitInfo> hitViews_;
+    mutable unsigned numOngoingHitViews_{};
+    mutable bool hitViewsDirty_{};
+    mutable double hitViewsElapsedTime_{};
+    /// @}
+    HitListenerList listeners_;
 
-    HitId nextId_{};
+    ea::vector<HitIdSlot> idSlots_;
+    ea::vector<unsigned> freeIdSlots_;
+    /// Index in HitManager list of scheduled owners.
+    unsigned scheduledIndex_{M_MAX_UNSIGNED};
+    HitHandle hitHandle_{};
 
     float triggerFadeOut_{};
+    unsigned teamMask_{M_MAX_UNSIGNED};
+    unsigned targetTeamMask_{M_MAX_UNSIGNED};
 };
 
 class PLUGIN_CORE_HITMANAGER_API HitComponent : public LogicComponent
@@ -102,29 +178,70 @@ public:
     static void RegisterObject(Context* context);
 
     HitOwner* GetHitOwner();
+    HitManager* GetHitManager();
     bool IsSelfAndOwnerEnabled();
 
+    /// Return group identifier interned in HitManager.
+    HitGroupId GetInternedGroupId();
+    /// Return handle of the component in HitManager, registering it on first call.
+    HitHandle GetHitHandle();
+
     /// Implement LogicComponent.
     /// @{
     void DelayedStart() override;
     /// @}
 
+    /// Return hit shape in world space.
+    HitShape GetWorldShape() const;
+
     /// Attributes.
     /// @{
-    void SetGroupId(const ea::string& value) { groupId_ = value; }
+    void SetGroupId(const ea::string& value);
     const ea::string& GetGroupId() const { return groupId_; }
+    void SetShapeType(HitShapeType value) { shapeType_ = value; }
+    HitShapeType GetShapeType() const { return shapeType_; }
+    void SetShapeSize(const Vector3& value) { shapeSize_ = value; }
+    const Vector3& GetShapeSize() const { return shapeSize_; }
+    void SetShapeOffset(const Vector3& value) { shapeOffset_ = value; }
+    const Vector3& GetShapeOffset() const { return shapeOffset_; }
     /// @}
 
-protected:
+    /// Internal.
+    /// @{
+    unsigned GetBroadphaseIndex() const { return broadphaseIndex_; }
+    void SetBroadphaseIndex(unsigned index) { broadphaseIndex_ = index; }
+    /// Configure rigid body created for the component. Called for detached body, before it is added to the node.
     virtual void SetupRigidBody(HitManager* hitManager, RigidBody* rigidBody) {}
+    /// @}
+
+protected:
+    /// Implement LogicComponent.
+    /// @{
+    void OnSceneSet(Scene* scene) override;
+    /// @}
 
     RigidBody* GetRigidBody() const { return rigidBody_; }
 
 private:
     WeakPtr<RigidBody> rigidBody_;
+    /// Body registered in HitManager. Kept as raw key, so registration is removed even if body is already destroyed.
+    const RigidBody* registeredBody_{};
+    /// Whether rigid body was acquired from HitManager pool and should be returned there.
+    bool isPooledBody_{};
+    /// Whether rigid body was created by the component and should be removed with it.
+    /// Body that was already on the node may be shared with other components and is left as is.
+    bool isOwnBody_{};
     WeakPtr<HitOwner> hitOwner_;
+    WeakPtr<HitManager> hitManager_;
 
     ea::string groupId_;
+    ea::optional<HitGroupId> internedGroupId_;
+
+    HitShapeType shapeType_{};
+    Vector3 shapeSize_{Vector3::ONE};
+    Vector3 shapeOffset_;
+    unsigned broadphaseIndex_{M_MAX_UNSIGNED};
+    HitHandle hitHandle_{};
 };
 
 class PLUGIN_CORE_HITMANAGER_API HitTrigger : public HitComponent
@@ -137,19 +254,42 @@ public:
 
     bool IsEnabledForDetector(HitDetector* hitDetector);
 
+    /// Implement LogicComponent.
+    /// @{
+    void DelayedStart() override;
+    /// @}
+
     /// Attributes.
     /// @{
+    /// Trigger is enabled only when moving at least this fast. Velocity of rigid body is used if there is one,
+    /// otherwise velocity is estimated from movement of the hit shape between updates.
     void SetVelocityThreshold(float value) { velocityThreshold_ = value; }
     float GetVelocityThreshold() const { return velocityThreshold_; }
+    /// Continuous trigger is tested against detectors along its path between updates, so it cannot skip thin
+    /// or small detectors when moving fast. Requires shape on both trigger and detectors.
+    void SetContinuous(bool value);
+    bool IsContinuous() const { return continuous_; }
+    /// @}
+
+    /// Internal.
+    /// @{
+    /// Evaluate whether the trigger is enabled and fast enough. Does nothing if already evaluated in this update.
+    void UpdateFrameState(unsigned evaluationIndex);
+    /// Return state evaluated by the last UpdateFrameState.
+    bool IsEnabledInFrame() const { return isEnabledInFrame_; }
     /// @}
 
 private:
     void SetupRigidBody(HitManager* hitManager, RigidBody* rigidBody) override;
 
-    float GetRigidBodyVelocity() const;
-    bool IsVelocityThresholdSatisfied() const;
+    float GetVelocitySquared();
+    bool IsVelocityThresholdSatisfied();
 
     float velocityThreshold_{};
+    bool continuous_{};
+
+    unsigned evaluationIndex_{M_MAX_UNSIGNED};
+    bool isEnabledInFrame_{};
 };
 
 class PLUGIN_CORE_HITMANAGER_API HitDetector : public HitComponent
@@ -160,16 +300,18 @@ public:
     using HitComponent::HitComponent;
     static void RegisterObject(Context* context);
 
-    /// Implement LogicComponent.
+    /// Internal.
     /// @{
-    void DelayedStart() override;
+    void OnHitStarted(HitTrigger* hitTrigger);
+    void OnHitStopped(HitTrigger* hitTrigger);
+    void OnHitSwept(HitTrigger* hitTrigger);
     /// @}
 
 private:
     void SetupRigidBody(HitManager* hitManager, RigidBody* rigidBody) override;
 
-    void OnHitStarted(HitTrigger* hitTrigger);
-    void OnHitStopped(HitTrigger* hitTrigger);
+    /// Return whether hit with trigger of another owner passes group pair rules and team masks.
+    bool IsHitAllowed(HitTrigger* hitTrigger);
 };
 
 } // namespace Urho3D
@@ -0,0 +1,182 @@
+#include "HitReplication.h"
+
+#include "HitManager.h"
+
+#include <EASTL/algorithm.h>
+
+namespace Urho3D
+{
+
+namespace
+{
+
+const unsigned VarUIntChunkBits = 4;
+const unsigned VarUIntChunkMask = (1u << VarUIntChunkBits) - 1;
+
+} // namespace
+
+void HitBitWriter::WriteBits(unsigned value, unsigned numBits)
+{
+    URHO3D_ASSERT(numBits <= 32);
+
+    while (numBits > 0)
+    {
+        const unsigned bitOffset = numBits_ % 8;
+        if (bitOffset == 0)
+            buffer_.push_back(0);
+
+        const unsigned count = ea::min(numBits, 8 - bitOffset);
+        buffer_.back() |= static_cast<unsigned char>((value & ((1u << count) - 1)) << bitOffset);
+        value >>= count;
+        numBits -= count;
+        numBits_ += count;
+    }
+}
+
+void HitBitWriter::WriteVarUInt(unsigned value)
+{
+    // Each chunk is followed by continuation bit
+    do
+    {
+        const unsigned chunk = value & VarUIntChunkMask;
+        value >>= VarUIntChunkBits;
+        WriteBits(chunk | (value != 0 ? 1u << VarUIntChunkBits : 0u), VarUIntChunkBits + 1);
+    } while (value != 0);
+}
+
+void HitBitWriter::WriteVarInt(int value)
+{
+    const auto bits = static_cast<unsigned>(value);
+    WriteVarUInt((bits << 1) ^ (value < 0 ? M_MAX_UNSIGNED : 0u));
+}
+
+void HitBitWriter::WriteString(const ea::string& value)
+{
+    WriteVarUInt(value.size());
+    for (const char ch : value)
+        WriteBits(static_cast<unsigned char>(ch), 8);
+}
+
+bool HitBitReader::ReadBits(unsigned& value, unsigned numBits)
+{
+    URHO3D_ASSERT(numBits <= 32);
+
+    if (bitOffset_ + numBits > buffer_.size() * 8)
+        return false;
+
+    value = 0;
+    unsigned shift = 0;
+    while (numBits > 0)
+    {
+        const unsigned bitOffset = bitOffset_ % 8;
+        const unsigned count = ea::min(numBits, 8 - bitOffset);
+        const unsigned bits = (buffer_[bitOffset_ / 8] >> bitOffset) & ((1u << count) - 1);
+        value |= bits << shift;
+        shift += count;
+        numBits -= count;
+        bitOffset_ += count;
+    }
+    return true;
+}
+
+bool HitBitReader::ReadBool(bool& value)
+{
+    unsigned bits{};
+    if (!ReadBits(bits, 1))
+        return false;
+    value = bits != 0;
+    return true;
+}
+
+bool HitBitReader::ReadVarUInt(unsigned& value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 32; shift += VarUIntChunkBits)
+    {
+        unsigned chunk{};
+        if (!ReadBits(chunk, VarUIntChunkBits + 1))
+            return false;
+
+        value |= (chunk & VarUIntChunkMask) << shift;
+        if ((chunk >> VarUIntChunkBits) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool HitBitReader::ReadVarInt(int& value)
+{
+    unsigned bits{};
+    if (!ReadVarUInt(bits))
+        return false;
+    value = static_cast<int>((bits >> 1) ^ (0u - (bits & 1u)));
+    return true;
+}
+
+bool HitBitReader::ReadString(ea::string& value)
+{
+    unsigned size{};
+    if (!ReadVarUInt(size) || bitOffset_ + size * 8ull > buffer_.size() * 8ull)
+        return false;
+
+    value.resize(size);
+    for (char& ch : value)
+    {
+        unsigned bits{};
+        ReadBits(bits, 8);
+        ch = static_cast<char>(bits);
+    }
+    return true;
+}
+
+HitReplicationLoopback::HitReplicationLoopback(HitManager* server)
+    : server_(server)
+{
+}
+
+void HitReplicationLoopback::AddClient(HitManager* client)
+{
+    const auto isSameClient = [&](const Client& entry) { return entry.hitManager_ == client; };
+    if (ea::find_if(clients_.begin(), clients_.end(), isSameClient) == clients_.end())
+        clients_.push_back(Client{WeakPtr<HitManager>{client}});
+}
+
+void HitReplicationLoopback::RemoveClient(HitManager* client)
+{
+    ea::erase_if(clients_, [&](const Client& entry) { return entry.hitManager_ == client; });
+}
+
+bool HitReplicationLoopback::Transfer()
+{
+    HitManager* server = server_;
+    if (!server)
+        return false;
+
+    ea::erase_if(clients_, [](const Client& entry) { return !entry.hitManager_; });
+
+    // Delta is consumed even if all clients are new, baseline already includes its result
+    const auto isNewClient = [](const Client& entry) { return !entry.hasBaseline_; };
+    const bool needBaseline = ea::any_of(clients_.begin(), clients_.end(), isNewClient);
+    if (needBaseline)
+        server->WriteReplicationBaseline(baselineBuffer_);
+    server->WriteReplicationDelta(deltaBuffer_);
+
+    bool success = true;
+    for (Client& client : clients_)
+    {
+        HitManager* hitManager = client.hitManager_;
+        if (!client.hasBaseline_)
+        {
+            client.hasBaseline_ = true;
+            success = hitManager->ApplyReplicationData(baselineBuffer_) && success;
+            numBytesTransferred_ += baselineBuffer_.size();
+            continue;
+        }
+
+        success = hitManager->ApplyReplicationData(deltaBuffer_) && success;
+        numBytesTransferred_ += deltaBuffer_.size();
+    }
+    return success;
+}
+
+} // namespace Urho3D
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "_Plugin.h"
+
+#include <Urho3D/Container/Ptr.h>
+
+#include <EASTL/span.h>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+
+namespace Urho3D
+{
+
+class HitManager;
+
+/// Appends bit-packed values to buffer. Bits are written starting from the least significant one.
+class PLUGIN_CORE_HITMANAGER_API HitBitWriter
+{
+public:
+    explicit HitBitWriter(ea::vector<unsigned char>& buffer) : buffer_(buffer) {}
+
+    void WriteBits(unsigned value, unsigned numBits);
+    void WriteBool(bool value) { WriteBits(value ? 1u : 0u, 1); }
+    /// Write unsigned integer using as few chunks as possible, small values take 5 bits.
+    void WriteVarUInt(unsigned value);
+    /// Write signed integer with zigzag encoding, so values close to zero are short.
+    void WriteVarInt(int value);
+    void WriteString(const ea::string& value);
+
+    unsigned GetNumBits() const { return numBits_; }
+
+private:
+    ea::vector<unsigned char>& buffer_;
+    unsigned numBits_{};
+};
+
+/// Reads values written by HitBitWriter. Reading past the end fails.
+class PLUGIN_CORE_HITMANAGER_API HitBitReader
+{
+public:
+    explicit HitBitReader(ea::span<const unsigned char> buffer) : buffer_(buffer) {}
+
+    bool ReadBits(unsigned& value, unsigned numBits);
+    bool ReadBool(bool& value);
+    bool ReadVarUInt(unsigned& value);
+    bool ReadVarInt(int& value);
+    bool ReadString(ea::string& value);
+
+private:
+    ea::span<const unsigned char> buffer_;
+    unsigned bitOffset_{};
+};
+
+/// In-process transport that replicates hits from server HitManager to client HitManagers.
+/// Server and client scenes are expected to have the same node IDs, e.g. loaded from the same resource.
+/// Useful for tests and for listen servers that mirror hits into local view scene.
+class PLUGIN_CORE_HITMANAGER_API HitReplicationLoopback
+{
+public:
+    explicit HitReplicationLoopback(HitManager* server);
+
+    /// Add or remove client. New client receives baseline instead of the next delta.
+    /// @{
+    void AddClient(HitManager* client);
+    void RemoveClient(HitManager* client);
+    /// @}
+
+    /// Take delta from server and apply it to all clients. Should be called after each server update.
+    /// Returns false if any client failed to apply the data.
+    bool Transfer();
+
+    /// Return size of the last delta in bytes.
+    unsigned GetLastDeltaSize() const { return deltaBuffer_.size(); }
+    /// Return total number of bytes transferred to all clients.
+    unsigned long long GetNumBytesTransferred() const { return numBytesTransferred_; }
+
+private:
+    struct Client
+    {
+        WeakPtr<HitManager> hitManager_;
+        bool hasBaseline_{};
+    };
+
+    WeakPtr<HitManager> server_;
+    ea::vector<Client> clients_;
+
+    ea::vector<unsigned char> deltaBuffer_;
+    ea::vector<unsigned char> baselineBuffer_;
+    unsigned long long numBytesTransferred_{};
+};
+
+} // namespace Urho3D
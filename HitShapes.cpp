@@ -0,0 +1,483 @@
+#include "HitShapes.h"
+
+#include "HitOwner.h"
+
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+
+namespace Urho3D
+{
+
+namespace
+{
+
+const float ShapeEpsilon = 1e-6f;
+const unsigned NumCapsuleBoxIterations = 4;
+
+Vector3 ClosestPointOnSegment(const Vector3& point, const Vector3& begin, const Vector3& end)
+{
+    const Vector3 direction = end - begin;
+    const float lengthSquared = direction.LengthSquared();
+    if (lengthSquared <= ShapeEpsilon)
+        return begin;
+
+    const float t = Clamp((point - begin).DotProduct(direction) / lengthSquared, 0.0f, 1.0f);
+    return begin + direction * t;
+}
+
+Vector3 ClosestPointInBox(const Vector3& point, const HitShape& box)
+{
+    const Vector3 offset = point - box.center_;
+    Vector3 result = box.center_;
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        const float extent = box.halfExtents_.Data()[i];
+        result += box.axes_[i] * Clamp(offset.DotProduct(box.axes_[i]), -extent, extent);
+    }
+    return result;
+}
+
+/// See "Real-Time Collision Detection" by Christer Ericson, 5.1.9.
+float SegmentSegmentDistanceSquared(const Vector3& begin1, const Vector3& end1, const Vector3& begin2, const Vector3& end2)
+{
+    const Vector3 d1 = end1 - begin1;
+    const Vector3 d2 = end2 - begin2;
+    const Vector3 r = begin1 - begin2;
+    const float a = d1.LengthSquared();
+    const float e = d2.LengthSquared();
+    const float f = d2.DotProduct(r);
+
+    float s = 0.0f;
+    float t = 0.0f;
+    if (a <= ShapeEpsilon && e <= ShapeEpsilon)
+        return r.LengthSquared();
+
+    if (a <= ShapeEpsilon)
+        t = Clamp(f / e, 0.0f, 1.0f);
+    else
+    {
+        const float c = d1.DotProduct(r);
+        if (e <= ShapeEpsilon)
+            s = Clamp(-c / a, 0.0f, 1.0f);
+        else
+        {
+            const float b = d1.DotProduct(d2);
+            const float denom = a * e - b * b;
+            s = denom != 0.0f ? Clamp((b * f - c * e) / denom, 0.0f, 1.0f) : 0.0f;
+            t = (b * s + f) / e;
+            if (t < 0.0f)
+            {
+                t = 0.0f;
+                s = Clamp(-c / a, 0.0f, 1.0f);
+            }
+            else if (t > 1.0f)
+            {
+                t = 1.0f;
+                s = Clamp((b - c) / a, 0.0f, 1.0f);
+            }
+        }
+    }
+
+    const Vector3 closest1 = begin1 + d1 * s;
+    const Vector3 closest2 = begin2 + d2 * t;
+    return (closest1 - closest2).LengthSquared();
+}
+
+bool OverlapCapsuleCapsule(const HitShape& lhs, const HitShape& rhs)
+{
+    const float radius = lhs.radius_ + rhs.radius_;
+    const float distanceSquared =
+        SegmentSegmentDistanceSquared(lhs.segmentBegin_, lhs.segmentEnd_, rhs.segmentBegin_, rhs.segmentEnd_);
+    return distanceSquared <= radius * radius;
+}
+
+/// Closest points are found by alternating projections, which converge for convex shapes.
+bool OverlapCapsuleBox(const HitShape& capsule, const HitShape& box)
+{
+    Vector3 pointOnSegment = ClosestPointOnSegment(box.center_, capsule.segmentBegin_, capsule.segmentEnd_);
+    Vector3 pointInBox = ClosestPointInBox(pointOnSegment, box);
+    for (unsigned i = 0; i < NumCapsuleBoxIterations; ++i)
+    {
+        pointOnSegment = ClosestPointOnSegment(pointInBox, capsule.segmentBegin_, capsule.segmentEnd_);
+        pointInBox = ClosestPointInBox(pointOnSegment, box);
+    }
+
+    return (pointInBox - pointOnSegment).LengthSquared() <= capsule.radius_ * capsule.radius_;
+}
+
+/// Separating axis test, see "Real-Time Collision Detection" by Christer Ericson, 4.4.1.
+bool OverlapBoxBox(const HitShape& lhs, const HitShape& rhs)
+{
+    const float* ea = lhs.halfExtents_.Data();
+    const float* eb = rhs.halfExtents_.Data();
+
+    float r[3][3];
+    float absR[3][3];
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        for (unsigned j = 0; j < 3; ++j)
+        {
+            r[i][j] = lhs.axes_[i].DotProduct(rhs.axes_[j]);
+            absR[i][j] = Abs(r[i][j]) + ShapeEpsilon;
+        }
+    }
+
+    const Vector3 offset = rhs.center_ - lhs.center_;
+    const float t[3]{offset.DotProduct(lhs.axes_[0]), offset.DotProduct(lhs.axes_[1]), offset.DotProduct(lhs.axes_[2])};
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        const float ra = ea[i];
+        const float rb = eb[0] * absR[i][0] + eb[1] * absR[i][1] + eb[2] * absR[i][2];
+        if (Abs(t[i]) > ra + rb)
+            return false;
+    }
+
+    for (unsigned j = 0; j < 3; ++j)
+    {
+        const float ra = ea[0] * absR[0][j] + ea[1] * absR[1][j] + ea[2] * absR[2][j];
+        const float rb = eb[j];
+        if (Abs(t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j]) > ra + rb)
+            return false;
+    }
+
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        const unsigned i1 = (i + 1) % 3;
+        const unsigned i2 = (i + 2) % 3;
+        for (unsigned j = 0; j < 3; ++j)
+        {
+            const unsigned j1 = (j + 1) % 3;
+            const unsigned j2 = (j + 2) % 3;
+            const float ra = ea[i1] * absR[i2][j] + ea[i2] * absR[i1][j];
+            const float rb = eb[j1] * absR[i][j2] + eb[j2] * absR[i][j1];
+            if (Abs(t[i2] * r[i1][j] - t[i1] * r[i2][j]) > ra + rb)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool IsSegmentShape(HitShapeType type)
+{
+    return type != HitShapeType::Box;
+}
+
+bool OverlapBoundingBoxes(const BoundingBox& lhs, const BoundingBox& rhs)
+{
+    return lhs.min_.x_ <= rhs.max_.x_ && lhs.max_.x_ >= rhs.min_.x_ //
+        && lhs.min_.y_ <= rhs.max_.y_ && lhs.max_.y_ >= rhs.min_.y_ //
+        && lhs.min_.z_ <= rhs.max_.z_ && lhs.max_.z_ >= rhs.min_.z_;
+}
+
+BoundingBox GetSegmentBoundingBox(const Vector3& begin, const Vector3& end, float radius)
+{
+    const Vector3 extent{radius, radius, radius};
+    return BoundingBox{VectorMin(begin, end) - extent, VectorMax(begin, end) + extent};
+}
+
+unsigned long long MakePairKey(unsigned detectorSerial, unsigned triggerSerial)
+{
+    return (static_cast<unsigned long long>(detectorSerial) << 32) | triggerSerial;
+}
+
+} // namespace
+
+HitShape HitShape::Create(HitShapeType type, const Vector3& size, const Vector3& offset, const Vector3& worldPosition,
+    const Quaternion& worldRotation, const Vector3& worldScale)
+{
+    const Vector3 scale = worldScale.Abs();
+    const Vector3 center = worldPosition + worldRotation * (worldScale * offset);
+
+    HitShape shape;
+    shape.type_ = type;
+    switch (type)
+    {
+    case HitShapeType::Capsule:
+    {
+        shape.radius_ = 0.5f * size.x_ * Max(scale.x_, scale.z_);
+        const float halfSegment = Max(0.0f, 0.5f * size.y_ * scale.y_ - shape.radius_);
+        const Vector3 axis = worldRotation * Vector3::UP;
+        shape.segmentBegin_ = center - axis * halfSegment;
+        shape.segmentEnd_ = center + axis * halfSegment;
+        break;
+    }
+
+    case HitShapeType::Box:
+    {
+        shape.center_ = center;
+        shape.axes_[0] = worldRotation * Vector3::RIGHT;
+        shape.axes_[1] = worldRotation * Vector3::UP;
+        shape.axes_[2] = worldRotation * Vector3::FORWARD;
+        shape.halfExtents_ = 0.5f * size * scale;
+        break;
+    }
+
+    case HitShapeType::Sphere:
+    case HitShapeType::None:
+    default:
+    {
+        shape.radius_ = 0.5f * size.x_ * Max(scale.x_, Max(scale.y_, scale.z_));
+        shape.segmentBegin_ = center;
+        shape.segmentEnd_ = center;
+        break;
+    }
+    }
+
+    if (type == HitShapeType::Box)
+    {
+        const Vector3 extent = (shape.axes_[0] * shape.halfExtents_.x_).Abs()
+            + (shape.axes_[1] * shape.halfExtents_.y_).Abs() + (shape.axes_[2] * shape.halfExtents_.z_).Abs();
+        shape.boundingBox_ = BoundingBox{shape.center_ - extent, shape.center_ + extent};
+    }
+    else
+        shape.boundingBox_ = GetSegmentBoundingBox(shape.segmentBegin_, shape.segmentEnd_, shape.radius_);
+
+    return shape;
+}
+
+HitShape HitShape::CreateSweep(const HitShape& shape, const Vector3& previousCenter)
+{
+    HitShape sweep;
+    sweep.type_ = HitShapeType::Capsule;
+    sweep.segmentBegin_ = previousCenter;
+    sweep.segmentEnd_ = shape.GetCenter();
+    sweep.radius_ = shape.GetInnerRadius();
+    sweep.boundingBox_ = GetSegmentBoundingBox(sweep.segmentBegin_, sweep.segmentEnd_, sweep.radius_);
+    return sweep;
+}
+
+Vector3 HitShape::GetCenter() const
+{
+    return IsSegmentShape(type_) ? (segmentBegin_ + segmentEnd_) * 0.5f : center_;
+}
+
+float HitShape::GetInnerRadius() const
+{
+    return IsSegmentShape(type_) ? radius_ : Min(halfExtents_.x_, Min(halfExtents_.y_, halfExtents_.z_));
+}
+
+bool HitShape::Overlaps(const HitShape& other) const
+{
+    if (!OverlapBoundingBoxes(boundingBox_, other.boundingBox_))
+        return false;
+
+    const bool isSegment = IsSegmentShape(type_);
+    const bool isOtherSegment = IsSegmentShape(other.type_);
+    if (isSegment && isOtherSegment)
+        return OverlapCapsuleCapsule(*this, other);
+    else if (isSegment)
+        return OverlapCapsuleBox(*this, other);
+    else if (isOtherSegment)
+        return OverlapCapsuleBox(other, *this);
+    else
+        return OverlapBoxBox(*this, other);
+}
+
+HitBroadphase::~HitBroadphase()
+{
+    for (const Entry& entry : entries_)
+        entry.component_->SetBroadphaseIndex(M_MAX_UNSIGNED);
+}
+
+void HitBroadphase::AddComponent(HitComponent* component)
+{
+    if (component->GetBroadphaseIndex() != M_MAX_UNSIGNED)
+        return;
+
+    Entry entry;
+    entry.component_ = component;
+    entry.detector_ = component->IsInstanceOf<HitDetector>() ? static_cast<HitDetector*>(component) : nullptr;
+    entry.trigger_ = component->IsInstanceOf<HitTrigger>() ? static_cast<HitTrigger*>(component) : nullptr;
+    entry.serial_ = nextSerial_++;
+    entry.shape_ = component->GetWorldShape();
+
+    component->SetBroadphaseIndex(entries_.size());
+    entries_.push_back(entry);
+    isSortedEntriesDirty_ = true;
+}
+
+void HitBroadphase::RemoveComponent(HitComponent* component, bool notifyStopped)
+{
+    const unsigned index = component->GetBroadphaseIndex();
+    if (index == M_MAX_UNSIGNED)
+        return;
+
+    const unsigned serial = entries_[index].serial_;
+    const auto isRemovedPair = [&](const Pair& pair)
+    {
+        return static_cast<unsigned>(pair.key_ >> 32) == serial || static_cast<unsigned>(pair.key_) == serial;
+    };
+
+    if (notifyStopped)
+    {
+        for (const Pair& pair : previousPairs_)
+        {
+            if (isRemovedPair(pair))
+                pair.detector_->OnHitStopped(pair.trigger_);
+        }
+    }
+    ea::erase_if(previousPairs_, isRemovedPair);
+
+    component->SetBroadphaseIndex(M_MAX_UNSIGNED);
+    if (index + 1 != entries_.size())
+    {
+        entries_[index] = entries_.back();
+        entries_[index].component_->SetBroadphaseIndex(index);
+    }
+    entries_.pop_back();
+    isSortedEntriesDirty_ = true;
+}
+
+void HitBroadphase::UpdatePairs()
+{
+    FindPairs();
+    NotifyChangedPairs();
+}
+
+void HitBroadphase::RestorePair(HitDetector* detector, HitTrigger* trigger)
+{
+    const unsigned detectorIndex = detector->GetBroadphaseIndex();
+    const unsigned triggerIndex = trigger->GetBroadphaseIndex();
+    if (detectorIndex >= entries_.size() || triggerIndex >= entries_.size())
+        return;
+
+    const unsigned long long key = MakePairKey(entries_[detectorIndex].serial_, entries_[triggerIndex].serial_);
+    previousPairs_.push_back(Pair{key, detector, trigger});
+}
+
+void HitBroadphase::SortPairs()
+{
+    ea::sort(previousPairs_.begin(), previousPairs_.end());
+}
+
+void HitBroadphase::UpdateShapes(float timeStep)
+{
+    for (Entry& entry : entries_)
+    {
+        const Vector3 previousCenter = entry.shape_.GetCenter();
+        entry.shape_ = entry.component_->GetWorldShape();
+        entry.velocity_ = timeStep > 0.0f ? (entry.shape_.GetCenter() - previousCenter) / timeStep : Vector3::ZERO;
+    }
+
+    SortEntries();
+}
+
+const HitShape* HitBroadphase::GetShape(const HitComponent* component) const
+{
+    const unsigned index = component->GetBroadphaseIndex();
+    return index < entries_.size() ? &entries_[index].shape_ : nullptr;
+}
+
+Vector3 HitBroadphase::GetVelocity(const HitComponent* component) const
+{
+    const unsigned index = component->GetBroadphaseIndex();
+    return index < entries_.size() ? entries_[index].velocity_ : Vector3::ZERO;
+}
+
+void HitBroadphase::QueryDetectors(const HitShape& shape, ea::vector<HitDetector*>& detectors)
+{
+    if (isSortedEntriesDirty_)
+        SortEntries();
+
+    // Entry overlapping the shape cannot start further to the left than the widest entry
+    const float beginX = shape.boundingBox_.min_.x_ - maxEntrySizeX_;
+    const float endX = shape.boundingBox_.max_.x_;
+    const auto isLessMinX = [&](unsigned index, float x) { return entries_[index].shape_.boundingBox_.min_.x_ < x; };
+    const auto iterBegin = ea::lower_bound(sortedEntries_.begin(), sortedEntries_.end(), beginX, isLessMinX);
+
+    for (auto iter = iterBegin; iter != sortedEntries_.end(); ++iter)
+    {
+        const Entry& entry = entries_[*iter];
+        if (entry.shape_.boundingBox_.min_.x_ > endX)
+            break;
+
+        if (entry.detector_ && entry.shape_.Overlaps(shape))
+            detectors.push_back(entry.detector_);
+    }
+}
+
+void HitBroadphase::SortEntries()
+{
+    const unsigned numEntries = entries_.size();
+    sortedEntries_.resize(numEntries);
+    maxEntrySizeX_ = 0.0f;
+    for (unsigned i = 0; i < numEntries; ++i)
+    {
+        const BoundingBox& boundingBox = entries_[i].shape_.boundingBox_;
+        sortedEntries_[i] = i;
+        maxEntrySizeX_ = ea::max(maxEntrySizeX_, boundingBox.max_.x_ - boundingBox.min_.x_);
+    }
+
+    const auto isLessMinX = [&](unsigned lhs, unsigned rhs)
+    { return entries_[lhs].shape_.boundingBox_.min_.x_ < entries_[rhs].shape_.boundingBox_.min_.x_; };
+    ea::sort(sortedEntries_.begin(), sortedEntries_.end(), isLessMinX);
+    isSortedEntriesDirty_ = false;
+}
+
+void HitBroadphase::FindPairs()
+{
+    pairs_.clear();
+
+    if (isSortedEntriesDirty_)
+        SortEntries();
+
+    const unsigned numEntries = sortedEntries_.size();
+    for (unsigned i = 0; i < numEntries; ++i)
+    {
+        const Entry& entry = entries_[sortedEntries_[i]];
+        const float maxX = entry.shape_.boundingBox_.max_.x_;
+
+        for (unsigned j = i + 1; j < numEntries; ++j)
+        {
+            const Entry& otherEntry = entries_[sortedEntries_[j]];
+            if (otherEntry.shape_.boundingBox_.min_.x_ > maxX)
+                break;
+
+            if (entry.detector_ && otherEntry.trigger_)
+                AddPair(entry, otherEntry);
+            else if (entry.trigger_ && otherEntry.detector_)
+                AddPair(otherEntry, entry);
+        }
+    }
+
+    ea::sort(pairs_.begin(), pairs_.end());
+}
+
+void HitBroadphase::AddPair(const Entry& detectorEntry, const Entry& triggerEntry)
+{
+    if (!detectorEntry.shape_.Overlaps(triggerEntry.shape_))
+        return;
+
+    const unsigned long long key = MakePairKey(detectorEntry.serial_, triggerEntry.serial_);
+    pairs_.push_back(Pair{key, detectorEntry.detector_, triggerEntry.trigger_});
+}
+
+void HitBroadphase::NotifyChangedPairs()
+{
+    auto iterPrevious = previousPairs_.begin();
+    auto iterCurrent = pairs_.begin();
+    while (iterPrevious != previousPairs_.end() || iterCurrent != pairs_.end())
+    {
+        if (iterCurrent == pairs_.end() || (iterPrevious != previousPairs_.end() && *iterPrevious < *iterCurrent))
+        {
+            iterPrevious->detector_->OnHitStopped(iterPrevious->trigger_);
+            ++iterPrevious;
+        }
+        else if (iterPrevious == previousPairs_.end() || *iterCurrent < *iterPrevious)
+        {
+            iterCurrent->detector_->OnHitStarted(iterCurrent->trigger_);
+            ++iterCurrent;
+        }
+        else
+        {
+            ++iterPrevious;
+            ++iterCurrent;
+        }
+    }
+
+    ea::swap(pairs_, previousPairs_);
+}
+
+} // namespace Urho3D
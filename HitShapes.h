@@ -0,0 +1,146 @@
+#pragma once
+
+#include "_Plugin.h"
+
+#include <Urho3D/Math/BoundingBox.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include <EASTL/vector.h>
+
+namespace Urho3D
+{
+
+class HitComponent;
+class HitDetector;
+class HitTrigger;
+
+/// Shape of hit volume used when HitManager detects hits without physics.
+enum class HitShapeType
+{
+    None,
+    Sphere,
+    Capsule,
+    Box
+};
+
+/// Hit volume in world space.
+/// Spheres and capsules are represented as segments with radius, boxes are oriented boxes.
+struct PLUGIN_CORE_HITMANAGER_API HitShape
+{
+    HitShapeType type_{};
+
+    /// Sphere and capsule.
+    /// @{
+    Vector3 segmentBegin_;
+    Vector3 segmentEnd_;
+    float radius_{};
+    /// @}
+
+    /// Box.
+    /// @{
+    Vector3 center_;
+    Vector3 axes_[3]{Vector3::RIGHT, Vector3::UP, Vector3::FORWARD};
+    Vector3 halfExtents_;
+    /// @}
+
+    BoundingBox boundingBox_;
+
+    /// Create shape from local description. Size follows CollisionShape conventions:
+    /// sphere diameter is size.x, capsule diameter and height are size.x and size.y, box size is size.
+    static HitShape Create(HitShapeType type, const Vector3& size, const Vector3& offset, const Vector3& worldPosition,
+        const Quaternion& worldRotation, const Vector3& worldScale);
+
+    /// Create capsule swept by the inner sphere of the shape moving from previous center to current center.
+    /// The sweep never extends past the volume covered by the moving shape, but may miss hits grazing its edges.
+    static HitShape CreateSweep(const HitShape& shape, const Vector3& previousCenter);
+
+    /// Return center of the shape.
+    Vector3 GetCenter() const;
+    /// Return radius of the largest sphere around the center that fits into the shape.
+    float GetInnerRadius() const;
+
+    /// Return whether two shapes overlap. Capsule vs box test is approximate near the edges.
+    bool Overlaps(const HitShape& other) const;
+};
+
+/// Sweep-and-prune broadphase over HitComponent shapes.
+/// Notifies detectors about started and stopped overlaps with triggers.
+class PLUGIN_CORE_HITMANAGER_API HitBroadphase
+{
+public:
+    ~HitBroadphase();
+
+    /// Add or remove component. Removed component may be notified about stopped overlaps.
+    /// @{
+    void AddComponent(HitComponent* component);
+    void RemoveComponent(HitComponent* component, bool notifyStopped);
+    /// @}
+
+    /// Update shapes of all components and sort them along X axis.
+    /// Velocities of shapes are estimated from their movement during time step.
+    void UpdateShapes(float timeStep);
+    /// Find overlaps and notify detectors about changes since the previous call.
+    void UpdatePairs();
+    /// Return number of overlaps found by the last UpdatePairs and detector and trigger of each one.
+    /// @{
+    unsigned GetNumPairs() const { return previousPairs_.size(); }
+    HitDetector* GetPairDetector(unsigned index) const { return previousPairs_[index].detector_; }
+    HitTrigger* GetPairTrigger(unsigned index) const { return previousPairs_[index].trigger_; }
+    /// @}
+    /// Replace overlaps found by the last UpdatePairs without notifications, e.g. when hit state is restored.
+    /// Pairs of components that are not added are ignored. Next UpdatePairs reports changes relative to them.
+    /// @{
+    void ClearPairs() { previousPairs_.clear(); }
+    void RestorePair(HitDetector* detector, HitTrigger* trigger);
+    void SortPairs();
+    /// @}
+
+    /// Return current shape of the component, or null if the component is not added.
+    const HitShape* GetShape(const HitComponent* component) const;
+    /// Return velocity of the shape center estimated by the last UpdateShapes, or zero if the component is not added.
+    Vector3 GetVelocity(const HitComponent* component) const;
+    /// Collect detectors overlapping the shape. Results are appended to the vector.
+    /// Only entries within the X range of the shape are tested, see UpdateShapes.
+    void QueryDetectors(const HitShape& shape, ea::vector<HitDetector*>& detectors);
+
+    unsigned GetNumComponents() const { return entries_.size(); }
+
+private:
+    struct Entry
+    {
+        HitComponent* component_{};
+        HitDetector* detector_{};
+        HitTrigger* trigger_{};
+        /// Stable identifier used to order pairs deterministically.
+        unsigned serial_{};
+        HitShape shape_;
+        Vector3 velocity_;
+    };
+
+    struct Pair
+    {
+        unsigned long long key_{};
+        HitDetector* detector_{};
+        HitTrigger* trigger_{};
+
+        bool operator<(const Pair& rhs) const { return key_ < rhs.key_; }
+    };
+
+    void SortEntries();
+    void FindPairs();
+    void NotifyChangedPairs();
+    void AddPair(const Entry& detectorEntry, const Entry& triggerEntry);
+
+    ea::vector<Entry> entries_;
+    /// Indices of entries_ sorted by minimum X of bounding box, rebuilt when shapes or entries change.
+    ea::vector<unsigned> sortedEntries_;
+    bool isSortedEntriesDirty_{};
+    /// Largest size of entry bounding box along X axis, used to bound queries.
+    float maxEntrySizeX_{};
+    ea::vector<Pair> pairs_;
+    ea::vector<Pair> previousPairs_;
+    unsigned nextSerial_{};
+};
+
+} // namespace Urho3D
@@ -0,0 +1,460 @@
+#include "HitTrace.h"
+
+#include "HitOwner.h"
+
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include <EASTL/algorithm.h>
+
+#include <cstring>
+
+namespace Urho3D
+{
+
+namespace
+{
+
+const unsigned HitTraceMagic = 0x43525448; // "HTRC"
+const unsigned HitTraceVersion = 2;
+
+/// Records are written to file when this many are buffered at the end of the frame.
+const unsigned HitTraceFlushThreshold = 4096;
+
+unsigned FloatToBits(float value)
+{
+    unsigned bits{};
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float BitsToFloat(unsigned bits)
+{
+    float value{};
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool IsValidUpdateMode(unsigned mode)
+{
+    return mode <= static_cast<unsigned>(HitUpdateMode::PhysicsStep);
+}
+
+} // namespace
+
+HitTraceRecorder::HitTraceRecorder(HitManager* hitManager, File* file)
+    : hitManager_(hitManager)
+    , file_(file)
+{
+    HitTraceHeader header;
+    header.magic_ = HitTraceMagic;
+    header.version_ = HitTraceVersion;
+    header.recordSize_ = sizeof(HitTraceRecord);
+    header.updateMode_ = static_cast<unsigned>(hitManager_->GetUpdateMode());
+    file_->Write(&header, sizeof(header));
+}
+
+HitTraceRecorder::~HitTraceRecorder()
+{
+    Flush();
+}
+
+void HitTraceRecorder::RecordBeginFrame(unsigned frameIndex, float timeStep)
+{
+    numOwnerSteps_ = 0;
+    AddRecord(HitTraceRecordType::BeginFrame, frameIndex, FloatToBits(timeStep));
+}
+
+void HitTraceRecorder::RecordUpdateOwners(bool isParallel)
+{
+    AddRecord(HitTraceRecordType::UpdateOwners, isParallel ? 1u : 0u);
+}
+
+void HitTraceRecorder::RecordOwnerStep()
+{
+    AddRecord(HitTraceRecordType::OwnerStep, numOwnerSteps_++);
+}
+
+void HitTraceRecorder::RecordEndFrame()
+{
+    AddRecord(HitTraceRecordType::EndFrame, 0);
+    if (buffer_.size() >= HitTraceFlushThreshold)
+        Flush();
+}
+
+void HitTraceRecorder::RecordHit(HitTraceRecordType type, HitDetector* detector, HitTrigger* trigger)
+{
+    DefineComponent(detector, HitTraceRecordType::Detector);
+    DefineComponent(trigger, HitTraceRecordType::Trigger);
+    AddRecord(type, static_cast<unsigned>(detector->GetHitHandle()), static_cast<unsigned>(trigger->GetHitHandle()));
+}
+
+void HitTraceRecorder::RecordOwnerEnabled(HitOwner* owner)
+{
+    DefineOwner(owner);
+    RecordEnabled(HitTraceRecordType::OwnerEnabled, owner->GetHitHandle(), owner->IsEnabled());
+}
+
+void HitTraceRecorder::RecordTriggerEnabled(HitTrigger* trigger)
+{
+    DefineComponent(trigger, HitTraceRecordType::Trigger);
+    RecordEnabled(HitTraceRecordType::TriggerEnabled, trigger->GetHitHandle(), trigger->IsEnabledInFrame());
+}
+
+void HitTraceRecorder::RecordRemoveObject(HitHandle handle)
+{
+    if (definedObjects_.erase(handle) == 0)
+        return;
+
+    enabledStates_.erase(handle);
+    AddRecord(HitTraceRecordType::RemoveObject, static_cast<unsigned>(handle));
+}
+
+void HitTraceRecorder::RecordUpdateMode(HitUpdateMode mode)
+{
+    AddRecord(HitTraceRecordType::UpdateMode, static_cast<unsigned>(mode));
+}
+
+void HitTraceRecorder::Flush()
+{
+    if (buffer_.empty())
+        return;
+
+    file_->Write(buffer_.data(), buffer_.size() * sizeof(HitTraceRecord));
+    file_->Flush();
+    buffer_.clear();
+}
+
+void HitTraceRecorder::AddRecord(HitTraceRecordType type, unsigned arg0, unsigned arg1, unsigned arg2)
+{
+    buffer_.push_back(HitTraceRecord{type, {arg0, arg1, arg2}});
+    ++numRecords_;
+}
+
+void HitTraceRecorder::DefineOwner(HitOwner* owner)
+{
+    const HitHandle handle = owner->GetHitHandle();
+    if (!definedObjects_.insert(handle).second)
+        return;
+
+    const auto index = static_cast<unsigned>(handle);
+    AddRecord(HitTraceRecordType::Owner, index, owner->GetTeamMask(), owner->GetTargetTeamMask());
+    AddRecord(HitTraceRecordType::OwnerFadeOut, index, FloatToBits(owner->GetTriggerFadeOut()));
+}
+
+void HitTraceRecorder::DefineComponent(HitComponent* component, HitTraceRecordType type)
+{
+    const HitHandle handle = component->GetHitHandle();
+    if (definedObjects_.count(handle) != 0)
+        return;
+
+    // Owner and group should be defined before the component that references them
+    HitOwner* owner = component->GetHitOwner();
+    if (!owner)
+        return;
+
+    const HitGroupId groupId = component->GetInternedGroupId();
+    DefineOwner(owner);
+    DefineGroup(groupId);
+
+    definedObjects_.insert(handle);
+    AddRecord(type, static_cast<unsigned>(handle), static_cast<unsigned>(owner->GetHitHandle()),
+        static_cast<unsigned>(groupId));
+}
+
+void HitTraceRecorder::DefineGroup(HitGroupId groupId)
+{
+    const auto index = static_cast<unsigned>(groupId);
+    if (index < definedGroups_.size() && definedGroups_[index])
+        return;
+
+    if (index >= definedGroups_.size())
+        definedGroups_.resize(index + 1, false);
+    definedGroups_[index] = true;
+
+    const ea::string& name = hitManager_->GetGroupName(groupId);
+    AddRecord(HitTraceRecordType::GroupName, index, name.size());
+    for (unsigned offset = 0; offset < name.size(); offset += sizeof(HitTraceRecord::args_))
+    {
+        HitTraceRecord record{HitTraceRecordType::Data};
+        memcpy(record.args_, name.data() + offset, ea::min<unsigned>(sizeof(record.args_), name.size() - offset));
+        buffer_.push_back(record);
+        ++numRecords_;
+    }
+}
+
+void HitTraceRecorder::RecordEnabled(HitTraceRecordType type, HitHandle handle, bool enabled)
+{
+    const auto [iter, isInserted] = enabledStates_.emplace(handle, enabled);
+    if (!isInserted && iter->second == enabled)
+        return;
+
+    iter->second = enabled;
+    AddRecord(type, static_cast<unsigned>(handle), enabled ? 1u : 0u);
+}
+
+HitTraceReplayer::HitTraceReplayer(Context* context)
+    : scene_(MakeShared<Scene>(context))
+{
+    hitManager_ = scene_->CreateComponent<HitManager>();
+    hitManager_->SetTraceReplayer(this);
+}
+
+HitTraceReplayer::~HitTraceReplayer() = default;
+
+HitOwner* HitTraceReplayer::GetOwner(unsigned handle) const
+{
+    return GetComponent(owners_, handle);
+}
+
+template <class T>
+T* HitTraceReplayer::GetComponent(const ea::unordered_map<unsigned, WeakPtr<T>>& components, unsigned handle) const
+{
+    const auto iter = components.find(handle);
+    return iter != components.end() ? iter->second.Get() : nullptr;
+}
+
+bool HitTraceReplayer::LoadFile(const ea::string& fileName)
+{
+    File file(scene_->GetContext(), fileName, FILE_READ);
+    if (!file.IsOpen())
+    {
+        URHO3D_LOGERROR("Cannot open hit trace '{}'", fileName);
+        return false;
+    }
+
+    data_.resize(file.GetSize());
+    if (file.Read(data_.data(), data_.size()) != data_.size())
+    {
+        URHO3D_LOGERROR("Cannot read hit trace '{}'", fileName);
+        return false;
+    }
+
+    return Open(data_);
+}
+
+bool HitTraceReplayer::Open(ea::span<const unsigned char> data)
+{
+    HitTraceHeader header;
+    if (data.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic_ != HitTraceMagic || header.version_ != HitTraceVersion
+        || header.recordSize_ != sizeof(HitTraceRecord) || !IsValidUpdateMode(header.updateMode_))
+    {
+        URHO3D_LOGERROR("Hit trace is invalid or has unsupported version");
+        return false;
+    }
+
+    // Ongoing hits removed before evaluation are handled differently in PhysicsStep mode
+    hitManager_->SetUpdateMode(static_cast<HitUpdateMode>(header.updateMode_));
+
+    // Trailing partial record may be left if recording was interrupted
+    const unsigned numRecords = (data.size() - sizeof(header)) / sizeof(HitTraceRecord);
+    records_ = {reinterpret_cast<const HitTraceRecord*>(data.data() + sizeof(header)), numRecords};
+    position_ = 0;
+    return true;
+}
+
+bool HitTraceReplayer::ReplayFrame()
+{
+    const unsigned numRecords = records_.size();
+
+    // Records before the frame are made between updates, e.g. by physics
+    while (position_ < numRecords && records_[position_].type_ != HitTraceRecordType::BeginFrame)
+        position_ = ApplyRecord(position_);
+    if (position_ >= numRecords)
+        return false;
+
+    const float timeStep = BitsToFloat(records_[position_].args_[1]);
+    const unsigned frameBegin = position_ + 1;
+    unsigned frameEnd = frameBegin;
+    while (frameEnd < numRecords && records_[frameEnd].type_ != HitTraceRecordType::EndFrame)
+        ++frameEnd;
+
+    unsigned ownersBegin = frameBegin;
+    while (ownersBegin < frameEnd && records_[ownersBegin].type_ != HitTraceRecordType::UpdateOwners)
+        ++ownersBegin;
+
+    // Hits found by the update itself and component states are applied before the update,
+    // changes made by event handlers are applied at owner steps during the update
+    for (unsigned index = frameBegin; index < ownersBegin;)
+        index = ApplyRecord(index);
+    for (unsigned index = ownersBegin; index < frameEnd;)
+        index = IsAppliedBeforeUpdate(records_[index].type_) ? ApplyRecord(index) : index + 1;
+
+    // Owners are split between steps the same way only if they are updated the same way
+    if (ownersBegin < frameEnd)
+        hitManager_->SetParallelUpdate(records_[ownersBegin].args_[0] != 0);
+
+    stepPosition_ = ownersBegin;
+    frameEnd_ = frameEnd;
+    hitManager_->Update(timeStep);
+
+    // Changes made after the last step, or at steps that did not happen during replay
+    while (stepPosition_ < frameEnd_)
+        ReplayOwnerStep();
+
+    position_ = ea::min(frameEnd + 1, numRecords);
+    ++numFramesReplayed_;
+    return true;
+}
+
+void HitTraceReplayer::ReplayOwnerStep()
+{
+    while (stepPosition_ < frameEnd_ && records_[stepPosition_].type_ != HitTraceRecordType::OwnerStep)
+    {
+        const HitTraceRecordType type = records_[stepPosition_].type_;
+        stepPosition_ = IsAppliedBeforeUpdate(type) ? stepPosition_ + 1 : ApplyRecord(stepPosition_);
+    }
+
+    // Skip the marker itself, the next step applies records made after it
+    if (stepPosition_ < frameEnd_)
+        ++stepPosition_;
+}
+
+bool HitTraceReplayer::IsAppliedBeforeUpdate(HitTraceRecordType type)
+{
+    switch (type)
+    {
+    case HitTraceRecordType::Owner:
+    case HitTraceRecordType::OwnerFadeOut:
+    case HitTraceRecordType::Detector:
+    case HitTraceRecordType::Trigger:
+    case HitTraceRecordType::GroupName:
+    case HitTraceRecordType::Data:
+    case HitTraceRecordType::OwnerEnabled:
+    case HitTraceRecordType::TriggerEnabled:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+unsigned HitTraceReplayer::ApplyRecord(unsigned index)
+{
+    const HitTraceRecord& record = records_[index];
+    const unsigned* args = record.args_;
+
+    switch (record.type_)
+    {
+    case HitTraceRecordType::Owner:
+    {
+        Node* node = scene_->CreateChild("Owner");
+        auto owner = node->CreateComponent<HitOwner>();
+        owner->SetTeamMask(args[1]);
+        owner->SetTargetTeamMask(args[2]);
+        owners_[args[0]] = owner;
+        break;
+    }
+
+    case HitTraceRecordType::OwnerFadeOut:
+        if (HitOwner* owner = GetOwner(args[0]))
+            owner->SetTriggerFadeOut(BitsToFloat(args[1]));
+        break;
+
+    case HitTraceRecordType::Detector:
+    case HitTraceRecordType::Trigger:
+    {
+        HitOwner* owner = GetOwner(args[1]);
+        if (!owner)
+            break;
+
+        const bool isDetector = record.type_ == HitTraceRecordType::Detector;
+        Node* node = owner->GetNode()->CreateChild(isDetector ? "Detector" : "Trigger");
+        const auto iter = groupNames_.find(args[2]);
+        const ea::string& groupName = iter != groupNames_.end() ? iter->second : EMPTY_STRING;
+        if (isDetector)
+        {
+            auto detector = node->CreateComponent<HitDetector>();
+            detector->SetGroupId(groupName);
+            detectors_[args[0]] = detector;
+        }
+        else
+        {
+            auto trigger = node->CreateComponent<HitTrigger>();
+            trigger->SetGroupId(groupName);
+            triggers_[args[0]] = trigger;
+        }
+        break;
+    }
+
+    case HitTraceRecordType::GroupName:
+    {
+        // Name is stored in following data records, truncated trace yields truncated name
+        ea::string& name = groupNames_[args[0]];
+        name.clear();
+        unsigned nextIndex = index + 1;
+        while (name.size() < args[1] && nextIndex < records_.size()
+            && records_[nextIndex].type_ == HitTraceRecordType::Data)
+        {
+            const auto chars = reinterpret_cast<const char*>(records_[nextIndex].args_);
+            const unsigned count = ea::min<unsigned>(sizeof(HitTraceRecord::args_), args[1] - name.size());
+            name.append(chars, chars + count);
+            ++nextIndex;
+        }
+        return nextIndex;
+    }
+
+    case HitTraceRecordType::OwnerEnabled:
+        if (HitOwner* owner = GetOwner(args[0]))
+            owner->SetEnabled(args[1] != 0);
+        break;
+
+    case HitTraceRecordType::TriggerEnabled:
+        // Recorded state includes velocity threshold and owner state, so it is applied to the trigger alone
+        if (HitTrigger* trigger = GetComponent(triggers_, args[0]))
+            trigger->SetEnabled(args[1] != 0);
+        break;
+
+    case HitTraceRecordType::AddOngoingHit:
+    case HitTraceRecordType::RemoveOngoingHit:
+    case HitTraceRecordType::AddTransientHit:
+    {
+        HitDetector* detector = GetComponent(detectors_, args[0]);
+        HitTrigger* trigger = GetComponent(triggers_, args[1]);
+        HitOwner* owner = detector ? detector->GetHitOwner() : nullptr;
+        if (!owner || !trigger)
+            break;
+
+        if (record.type_ == HitTraceRecordType::AddOngoingHit)
+            owner->AddOngoingHit(detector, trigger);
+        else if (record.type_ == HitTraceRecordType::RemoveOngoingHit)
+            owner->RemoveOngoingHit(detector, trigger);
+        else
+            owner->AddTransientHit(detector, trigger);
+        break;
+    }
+
+    case HitTraceRecordType::UpdateMode:
+        if (IsValidUpdateMode(args[0]))
+            hitManager_->SetUpdateMode(static_cast<HitUpdateMode>(args[0]));
+        break;
+
+    case HitTraceRecordType::RemoveObject:
+    {
+        // Handles are never reused, so only one of the maps may contain the object
+        if (HitOwner* owner = GetOwner(args[0]))
+            owner->GetNode()->Remove();
+        else if (HitDetector* detector = GetComponent(detectors_, args[0]))
+            detector->GetNode()->Remove();
+        else if (HitTrigger* trigger = GetComponent(triggers_, args[0]))
+            trigger->GetNode()->Remove();
+
+        owners_.erase(args[0]);
+        detectors_.erase(args[0]);
+        triggers_.erase(args[0]);
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    return index + 1;
+}
+
+} // namespace Urho3D
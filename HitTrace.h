@@ -0,0 +1,193 @@
+#pragma once
+
+#include "HitInfo.h"
+
+#include <Urho3D/Container/Ptr.h>
+
+#include <EASTL/span.h>
+#include <EASTL/string.h>
+#include <EASTL/unordered_map.h>
+#include <EASTL/unordered_set.h>
+#include <EASTL/vector.h>
+
+namespace Urho3D
+{
+
+class Context;
+class File;
+class HitComponent;
+class HitManager;
+class Node;
+class Scene;
+enum class HitUpdateMode;
+
+/// Type of trace record. Objects are referenced by HitHandle values at the time of recording.
+enum class HitTraceRecordType : unsigned
+{
+    /// Start of HitManager update: frame index, time step bits.
+    BeginFrame,
+    /// Owners are about to be updated: whether they are updated in parallel.
+    /// Records after this point are made by owner update or event handlers.
+    UpdateOwners,
+    /// Owner is about to be updated or to expire its hits: step index within the frame.
+    /// Records between steps are made by event handlers of the previous step.
+    OwnerStep,
+    /// End of HitManager update.
+    EndFrame,
+    /// Definition of owner: handle, team mask, target team mask.
+    Owner,
+    /// Trigger fade out of owner: handle, fade out bits.
+    OwnerFadeOut,
+    /// Definition of component: handle, owner handle, group id.
+    /// @{
+    Detector,
+    Trigger,
+    /// @}
+    /// Definition of group: group id, name length. Name is stored in following Data records.
+    GroupName,
+    /// Raw bytes of the preceding record.
+    Data,
+    /// Evaluated enabled state: handle, enabled flag.
+    /// @{
+    OwnerEnabled,
+    TriggerEnabled,
+    /// @}
+    /// Raw hit change: detector handle, trigger handle.
+    /// @{
+    AddOngoingHit,
+    RemoveOngoingHit,
+    AddTransientHit,
+    /// @}
+    /// Object is removed: handle.
+    RemoveObject,
+    /// Update mode of HitManager is changed: mode. Initial mode is stored in header.
+    UpdateMode
+};
+
+/// Fixed-size record of hit trace. Trace file is a HitTraceHeader followed by array of records,
+/// so it can be memory-mapped and scanned without parsing.
+struct HitTraceRecord
+{
+    HitTraceRecordType type_{};
+    unsigned args_[3]{};
+};
+
+/// Header of hit trace file.
+struct HitTraceHeader
+{
+    unsigned magic_{};
+    unsigned version_{};
+    unsigned recordSize_{};
+    /// Update mode of HitManager when recording started, see HitUpdateMode. It affects how raw hits are evaluated.
+    unsigned updateMode_{};
+};
+
+static_assert(sizeof(HitTraceRecord) == 16, "HitTraceRecord should have fixed size");
+static_assert(sizeof(HitTraceHeader) == sizeof(HitTraceRecord), "Records should stay aligned after header");
+
+/// Writes raw hits, component states and time steps of HitManager into append-only binary trace.
+/// Records are buffered in memory and written to file between updates.
+/// Objects are defined in the trace when they are first referenced.
+class PLUGIN_CORE_HITMANAGER_API HitTraceRecorder
+{
+public:
+    HitTraceRecorder(HitManager* hitManager, File* file);
+    ~HitTraceRecorder();
+
+    /// Frame markers, see HitTraceRecordType.
+    /// @{
+    void RecordBeginFrame(unsigned frameIndex, float timeStep);
+    void RecordUpdateOwners(bool isParallel);
+    void RecordOwnerStep();
+    void RecordEndFrame();
+    /// @}
+    /// Record raw hit change, type is one of AddOngoingHit, RemoveOngoingHit or AddTransientHit.
+    void RecordHit(HitTraceRecordType type, HitDetector* detector, HitTrigger* trigger);
+    /// Record evaluated enabled state if it has changed since the last record.
+    /// @{
+    void RecordOwnerEnabled(HitOwner* owner);
+    void RecordTriggerEnabled(HitTrigger* trigger);
+    /// @}
+    /// Record removal of owner or component, if it was ever defined in the trace.
+    void RecordRemoveObject(HitHandle handle);
+    /// Record change of update mode.
+    void RecordUpdateMode(HitUpdateMode mode);
+
+    /// Write buffered records to file.
+    void Flush();
+
+    unsigned long long GetNumRecords() const { return numRecords_; }
+
+private:
+    void AddRecord(HitTraceRecordType type, unsigned arg0, unsigned arg1 = 0, unsigned arg2 = 0);
+    void DefineOwner(HitOwner* owner);
+    void DefineComponent(HitComponent* component, HitTraceRecordType type);
+    void DefineGroup(HitGroupId groupId);
+    void RecordEnabled(HitTraceRecordType type, HitHandle handle, bool enabled);
+
+    HitManager* hitManager_{};
+    SharedPtr<File> file_;
+
+    ea::vector<HitTraceRecord> buffer_;
+    unsigned long long numRecords_{};
+    unsigned numOwnerSteps_{};
+
+    ea::unordered_set<HitHandle> definedObjects_;
+    ea::vector<bool> definedGroups_;
+    ea::unordered_map<HitHandle, bool> enabledStates_;
+};
+
+/// Replays hit trace in standalone scene without physics or original scene content.
+/// Owners and components are recreated from definitions in the trace, and each recorded frame
+/// is evaluated by HitManager::Update with the recorded time step and update mode. Changes made by event handlers
+/// are applied at the same owner update step where they were recorded.
+class PLUGIN_CORE_HITMANAGER_API HitTraceReplayer
+{
+public:
+    explicit HitTraceReplayer(Context* context);
+    ~HitTraceReplayer();
+
+    /// Load trace from file into memory.
+    bool LoadFile(const ea::string& fileName);
+    /// Use trace data in external memory, e.g. memory-mapped file. Data should outlive replayer.
+    bool Open(ea::span<const unsigned char> data);
+
+    /// Replay next recorded frame. Returns false if there are no more frames.
+    bool ReplayFrame();
+    /// Apply changes made by event handlers before the next recorded owner step. Called by HitManager.
+    void ReplayOwnerStep();
+
+    Scene* GetScene() const { return scene_; }
+    HitManager* GetHitManager() const { return hitManager_; }
+    unsigned GetNumFramesReplayed() const { return numFramesReplayed_; }
+
+private:
+    /// Apply record and return index of the next one.
+    unsigned ApplyRecord(unsigned index);
+    /// Return whether record should be applied before update, even if it is recorded during owner update.
+    static bool IsAppliedBeforeUpdate(HitTraceRecordType type);
+
+    HitOwner* GetOwner(unsigned handle) const;
+    template <class T>
+    T* GetComponent(const ea::unordered_map<unsigned, WeakPtr<T>>& components, unsigned handle) const;
+
+    SharedPtr<Scene> scene_;
+    HitManager* hitManager_{};
+
+    ea::vector<unsigned char> data_;
+    ea::span<const HitTraceRecord> records_;
+    unsigned position_{};
+    /// Position of the next record made by event handlers and end of the frame being replayed.
+    /// @{
+    unsigned stepPosition_{};
+    unsigned frameEnd_{};
+    /// @}
+    unsigned numFramesReplayed_{};
+
+    ea::unordered_map<unsigned, WeakPtr<HitOwner>> owners_;
+    ea::unordered_map<unsigned, WeakPtr<HitDetector>> detectors_;
+    ea::unordered_map<unsigned, WeakPtr<HitTrigger>> triggers_;
+    ea::unordered_map<unsigned, ea::string> groupNames_;
+};
+
+} // namespace Urho3D